@@ -0,0 +1,8 @@
+; loop kernel: WHILE loop with a stack-based expression body
+SET 10 0
+SET 11 0
+WHILE @10 < 1000000
+@11 = @11 + @10 * 3
+INC 10
+REPEAT
+TERM
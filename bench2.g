@@ -0,0 +1,12 @@
+; loop kernel: register-based arithmetic, counted with LT/JT
+SET 10 0
+SET 11 1
+loop:
+ADD @11 @10
+MUL @1 3
+AND @1 0xFFFFFF
+SET 11 @1
+INC 10
+LT @10 1000000
+JT @1 loop
+TERM
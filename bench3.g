@@ -0,0 +1,12 @@
+; loop kernel: subroutine calls
+SET 10 0
+loop:
+CALL f
+INC 10
+LT @10 200000
+JT @1 loop
+TERM
+f:
+ADD @20 @10
+SET 20 @1
+RET 0
@@ -0,0 +1,13 @@
+; loop kernel: wide immediates and chained results in R
+SET 10 0
+SET 11 0x123456789
+loop:
+ADD @11 0x9E3779B97F4A7C15
+XOR @1 0xC2B2AE3D27D4EB4F
+SHR @1 7
+ADD @1 @10
+SET 11 @1
+INC 10
+LT @10 1000000
+JT @1 loop
+TERM
@@ -50,8 +50,12 @@
      1:  || (Logical OR)
 */
 
+#ifndef EXPR_HPP
+#define EXPR_HPP
+
 #include <iostream>
 #include <sstream>
+#include <stdexcept>
 #include <string>
 #include <vector>
 #include <deque>
@@ -91,7 +95,7 @@ public:
 };
 
 
-std::ostream& operator<<(std::ostream& os, const Token& token) {
+inline std::ostream& operator<<(std::ostream& os, const Token& token) {
    if (token.type == Token::Type::Register)
       os << "@";
    os << token.str;
@@ -99,7 +103,7 @@ std::ostream& operator<<(std::ostream& os, const Token& token) {
 }
 
 
-std::deque<Token> exprToTokens(const std::string& expr) {
+inline std::deque<Token> exprToTokens(const std::string& expr) {
    std::deque<Token> tokens;
 
    for(const auto* p = expr.c_str(); *p; ++p) {
@@ -272,7 +276,7 @@ std::deque<Token> exprToTokens(const std::string& expr) {
 }
 
 
-std::deque<Token> shuntingYard(const std::deque<Token>& tokens) {
+inline std::deque<Token> shuntingYard(const std::deque<Token>& tokens) {
    std::deque<Token> queue;
    std::vector<Token> stack;
 
@@ -377,22 +381,32 @@ std::deque<Token> shuntingYard(const std::deque<Token>& tokens) {
 }
 
 
-// instead of evaluating a result, this returns the assembly program
-std::string expressionToGASM(const std::string& expr, bool lf) {
+// appends a binary operator to the program; if both of its operands were
+// just pushed, PUSH a PUSH b ADD becomes the superinstruction PADD a b.
+// ANDL is left alone (its stack form sets R) and so is ORL, which gasm
+// assembles as OR.
+inline void binaryToGASM(std::vector<std::string>& prog, const std::string& op) {
+   size_t n = prog.size();
+   if (op != "ANDL" && op != "ORL" && n >= 2 &&
+       prog[n - 2].compare(0, 5, "PUSH ") == 0 && prog[n - 1].compare(0, 5, "PUSH ") == 0) {
+      prog[n - 2] = "P" + op + " " + prog[n - 2].substr(5) + " " + prog[n - 1].substr(5);
+      prog.pop_back();
+   } else {
+      prog.push_back(op);
+   }
+}
+
+// instead of evaluating a result, this returns the assembly program, one
+// instruction per element
+inline std::vector<std::string> expressionToInstructions(const std::string& expr) {
 
-   // gasm output stream
-   std::ostringstream ossg;
+   // gasm output
+   std::vector<std::string> prog;
 
    // we don't care about actually computing the expression, so
    //  this replaces the result of each operation.
    std::string zero = "0";
 
-   char sep;
-   if (lf)
-      sep = '\n';
-   else
-      sep = ' ';
-
    const auto tokens = exprToTokens(expr);
    auto queue = shuntingYard(tokens);
    std::vector<Token> stack;
@@ -403,12 +417,19 @@ std::string expressionToGASM(const std::string& expr, bool lf) {
       switch(token.type) {
       case Token::Type::Register:
       case Token::Type::Number:
+      {
          stack.push_back(token);
-         ossg << "PUSH " << token << sep;
+         std::ostringstream push;
+         push << "PUSH " << token;
+         prog.push_back(push.str());
          break;
+      }
 
       case Token::Type::Operator:
       {
+         size_t operands = token.unary ? 1 : 2;
+         if (stack.size() < operands)
+            throw std::runtime_error("ERROR: missing operand for: " + token.str);
          if(token.unary) {
             stack.pop_back(); // rhs
             switch(token.str[0]) {
@@ -417,11 +438,11 @@ std::string expressionToGASM(const std::string& expr, bool lf) {
                break;
             case '~':                   // Special operator name for unary '~'
                stack.push_back(Token { Token::Type::Number, zero });
-               ossg << "NEG" << sep;
+               prog.push_back("NEG");
                break;
             case '!':                   // Special operator name for unary '~'
                stack.push_back(Token { Token::Type::Number, zero });
-               ossg << "NOT" << sep;
+               prog.push_back("NOT");
                break;
             }
          } else {
@@ -438,37 +459,37 @@ std::string expressionToGASM(const std::string& expr, bool lf) {
                throw std::runtime_error("ERROR: Operator error (2): " + token.str);
                break;
             case '^':
-               ossg << "XOR" << sep;
+               binaryToGASM(prog, "XOR");
                stack.push_back(Token { Token::Type::Number, zero });
                break;
             case '*':
-               ossg << "MUL" << sep;
+               binaryToGASM(prog, "MUL");
                stack.push_back(Token { Token::Type::Number, zero });
                break;
             case '/':
-               ossg << "DIV" << sep;
+               binaryToGASM(prog, "DIV");
                stack.push_back(Token { Token::Type::Number, zero });
                break;
             case '+':
-               ossg << "ADD" << sep;
+               binaryToGASM(prog, "ADD");
                stack.push_back(Token { Token::Type::Number, zero });
                break;
             case '-':
-               ossg << "SUB" << sep;
+               binaryToGASM(prog, "SUB");
                stack.push_back(Token { Token::Type::Number, zero });
                break;
             case '%':
-               ossg << "MOD" << sep;
+               binaryToGASM(prog, "MOD");
                stack.push_back(Token { Token::Type::Number, zero });
                break;
             case '&':
                switch (c2) {
                case '&':   // &&
-                  ossg << "ANDL" << sep;
+                  binaryToGASM(prog, "ANDL");
                   stack.push_back(Token { Token::Type::Number, zero });
                   break;
                case ' ':   // just &
-                  ossg << "AND" << sep;
+                  binaryToGASM(prog, "AND");
                   stack.push_back(Token { Token::Type::Number, zero });
                   break;
                default:
@@ -479,11 +500,11 @@ std::string expressionToGASM(const std::string& expr, bool lf) {
             case '|':
                switch (c2) {
                case '|':   // ||
-                  ossg << "ORL" << sep;
+                  binaryToGASM(prog, "ORL");
                   stack.push_back(Token { Token::Type::Number, zero });
                   break;
                case ' ':    // |
-                  ossg << "OR" << sep;
+                  binaryToGASM(prog, "OR");
                   stack.push_back(Token { Token::Type::Number, zero });
                   break;
                default:
@@ -494,15 +515,15 @@ std::string expressionToGASM(const std::string& expr, bool lf) {
             case '<':
                switch (c2) {
                case '<':   // <<
-                  ossg << "SHL" << sep;
+                  binaryToGASM(prog, "SHL");
                   stack.push_back(Token { Token::Type::Number, zero });
                   break;
                case '=':   // <=
-                  ossg << "LE" << sep;
+                  binaryToGASM(prog, "LE");
                   stack.push_back(Token { Token::Type::Number, zero });
                   break;
                case ' ':    // <
-                  ossg << "LT" << sep;
+                  binaryToGASM(prog, "LT");
                   stack.push_back(Token { Token::Type::Number, zero });
                   break;
                default:
@@ -513,15 +534,15 @@ std::string expressionToGASM(const std::string& expr, bool lf) {
             case '>':
                switch (c2) {
                case '>':   // >>
-                  ossg << "SHR" << sep;
+                  binaryToGASM(prog, "SHR");
                   stack.push_back(Token { Token::Type::Number, zero });
                   break;
                case '=':   // >=
-                  ossg << "GE" << sep;
+                  binaryToGASM(prog, "GE");
                   stack.push_back(Token { Token::Type::Number, zero });
                   break;
                case ' ':    // >
-                  ossg << "GT" << sep;
+                  binaryToGASM(prog, "GT");
                   stack.push_back(Token { Token::Type::Number, zero });
                   break;
                default:
@@ -532,7 +553,7 @@ std::string expressionToGASM(const std::string& expr, bool lf) {
             case '=':
                switch (c2) {
                case '=':   // ==
-                  ossg << "EQ" << sep;
+                  binaryToGASM(prog, "EQ");
                   stack.push_back(Token { Token::Type::Number, zero });
                   break;
                default:    // '='  (not supported) -- doing the Unknown token case
@@ -543,7 +564,7 @@ std::string expressionToGASM(const std::string& expr, bool lf) {
             case '!':
                switch (c2) {
                case '=':   // !=
-                  ossg << "NE" << sep;
+                  binaryToGASM(prog, "NE");
                   stack.push_back(Token { Token::Type::Number, zero });
                   break;
                default:
@@ -561,5 +582,17 @@ std::string expressionToGASM(const std::string& expr, bool lf) {
       }
    }
 
-   return ossg.str();
+   return prog;
 }
+
+// the assembly program as text, one instruction per line if 'lf'
+inline std::string expressionToGASM(const std::string& expr, bool lf) {
+   std::string prog;
+   for (const std::string& instruction : expressionToInstructions(expr)) {
+      prog += instruction;
+      prog += lf ? '\n' : ' ';
+   }
+   return prog;
+}
+
+#endif
@@ -0,0 +1,901 @@
+/*
+  GASM
+
+  Assembler library for the GVM (the gasm tool is gasm.cpp).
+
+  GAssembler turns GASM source, from a string or a stream, into bytecode in
+  memory: instructions are appended to a byte vector, and the STACK bit of
+  inferred stack operands and the addresses of labels are patched in that
+  vector, so assembling does no file I/O. The result is the raw bytecode
+  (code()), the contents of a container (contents(), see gprogram.hpp) or a
+  GProgram that a VM can run right away:
+
+    GAssembler assembler;
+    if (!assembler.assemble(source))
+       std::cerr << "line " << assembler.errorLine() << ": " << assembler.error() << std::endl;
+    GVM vm(io, assembler.program());
+
+  A GAssembler holds all the state of its assembly: labels, output and the
+  IF/WHILE macros being expanded. The opcode table is built once and only
+  read, so separate GAssemblers can assemble on separate threads at once
+  (gasm --batch does).
+
+  Each line is scanned once, in place, by a GLexer: its first word tells the
+  directives (DATA, @n =, =, IF, ELSE, END, WHILE, REPEAT) from instructions,
+  and the same scan goes on to read the expression or split the instructions
+  into tokens, without regular expressions.
+  Whitespace is allowed anywhere between the parts of a line, and any line
+  can end with a ; comment.
+
+  DATA address value... puts values in io[address], io[address + 1]... before
+  the program runs, without any code (the io image of the container).
+
+  TODO:
+
+  - nested control macros (if/else/end/while/repeat)
+
+  - #include "xxx.h" macro
+
+  - parse simple C constant declarations
+    - enum {
+    NAME = VALUE_OR_NAME ;
+    };
+    - const uint64_t NAME = VALUE_OR_NAME ;
+
+*/
+
+#ifndef GASM_HPP
+#define GASM_HPP
+
+#include "gvm.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <istream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "expr.hpp"
+
+typedef std::map<std::string, std::pair<uint8_t, uint8_t>> GOpcodeTable;
+
+// opcode string --> pair< opcode code, opcode num-operands  >; built on first
+// use and never changed, so any number of assemblies can read it at once
+inline const GOpcodeTable& opcodes() {
+   static const GOpcodeTable table = {
+      {"NOP", {OP_NOP,0}},
+      {"TERM", {OP_TERM,0}},
+      {"SET", {OP_SET,2}},
+      {"JMP", {OP_JMP,1}},   // labelref
+      {"ADD", {OP_ADD,2}},
+      {"SUB", {OP_SUB,2}},
+      {"MUL", {OP_MUL,2}},
+      {"DIV", {OP_DIV,2}},
+      {"MOD", {OP_MOD,2}},
+      {"OR", {OP_OR,2}},
+      {"ANDL", {OP_ANDL,2}},
+      {"XOR", {OP_XOR,2}},
+      {"NOT", {OP_NOT,1}},
+      {"SHL", {OP_SHL,2}},
+      {"SHR", {OP_SHR,2}},
+      {"INC", {OP_INC,1}},
+      {"DEC", {OP_DEC,1}},
+      {"PUSH", {OP_PUSH,1}},
+      {"POP", {OP_POP,1}},
+      {"AND", {OP_AND,2}},
+      {"HOST", {OP_HOST,0}},      // HOST n is HOSTN
+      {"HOSTN", {OP_HOSTN,1}},
+      {"VPUSH", {OP_VPUSH,2}},
+      {"VPOP", {OP_VPOP,2}},
+      {"CALL", {OP_CALL,1}}, // labelref
+      {"RET", {OP_RET,1}},
+      {"JF",{OP_JF,2}},      // 1 + labelref
+      {"JT",{OP_JT,2}},      // 1 + labelref
+      {"EQ", {OP_EQ,2}},
+      {"NE", {OP_NE,2}},
+      {"GT", {OP_GT,2}},
+      {"LT", {OP_LT,2}},
+      {"GE", {OP_GE,2}},
+      {"LE", {OP_LE,2}},
+      {"NEG", {OP_NEG,1}},
+      {"ORL", {OP_OR,2}},
+      // superinstructions
+      {"PADD", {OP_ADD | PUSHED,2}},
+      {"PSUB", {OP_SUB | PUSHED,2}},
+      {"PMUL", {OP_MUL | PUSHED,2}},
+      {"PDIV", {OP_DIV | PUSHED,2}},
+      {"PMOD", {OP_MOD | PUSHED,2}},
+      {"POR", {OP_OR | PUSHED,2}},
+      {"PXOR", {OP_XOR | PUSHED,2}},
+      {"PSHL", {OP_SHL | PUSHED,2}},
+      {"PSHR", {OP_SHR | PUSHED,2}},
+      {"PAND", {OP_AND | PUSHED,2}},
+      {"PEQ", {OP_EQ | PUSHED,2}},
+      {"PNE", {OP_NE | PUSHED,2}},
+      {"PGT", {OP_GT | PUSHED,2}},
+      {"PLT", {OP_LT | PUSHED,2}},
+      {"PGE", {OP_GE | PUSHED,2}},
+      {"PLE", {OP_LE | PUSHED,2}},
+      {"PORL", {OP_ORL | PUSHED,2}},
+      {"JFEQ", {OP_JFEQ,3}},       // 2 + labelref
+      {"JFNE", {OP_JFNE,3}},
+      {"JFGT", {OP_JFGT,3}},
+      {"JFLT", {OP_JFLT,3}},
+      {"JFGE", {OP_JFGE,3}},
+      {"JFLE", {OP_JFLE,3}},
+      {"INCJEQ", {OP_INCJEQ,3}},   // 2 + labelref
+      {"INCJNE", {OP_INCJNE,3}},
+      {"INCJGT", {OP_INCJGT,3}},
+      {"INCJLT", {OP_INCJLT,3}},
+      {"INCJGE", {OP_INCJGE,3}},
+      {"INCJLE", {OP_INCJLE,3}}
+   };
+   return table;
+}
+
+inline bool isJump(const uint8_t opcode) {
+   return opLayout(opcode).target; // JMP, CALL, JT, JF and the superinstructions that branch
+}
+
+inline bool isNumeric(const std::string &str) {
+   if (str.empty())
+      return false;
+
+   // check if the string is a decimal or hex number
+   char *endptr;
+   (void)strtol(str.c_str(), &endptr, 0);
+   return (*endptr == '\0');
+}
+
+// true if 'name' is a register index (@5, not @x)
+inline bool isRegister(std::string_view name) {
+   return name.size() > 1 && name[0] == '@' && std::all_of(name.begin() + 1, name.end(), [](char c) { return isdigit((unsigned char)c); });
+}
+
+// what a line of GASM is, by its first word (see GLexer::directive())
+enum {
+   DIRECTIVE_NONE,    // instructions and labels
+   DIRECTIVE_DATA,    // DATA address value...
+   DIRECTIVE_SET,     // @n = expression
+   DIRECTIVE_PUSH,    // = expression
+   DIRECTIVE_IF,      // IF expression
+   DIRECTIVE_ELSE,
+   DIRECTIVE_END,
+   DIRECTIVE_WHILE,   // WHILE expression
+   DIRECTIVE_REPEAT,
+};
+
+// scans one line of GASM in place, left to right; every method skips the
+// whitespace in front of what it looks for, and consumes nothing if it
+// doesn't find it
+class GLexer {
+public:
+   explicit GLexer(const std::string &line) : p(line.data()), end(line.data() + line.size()) {}
+
+   // the next whitespace-separated token, comments included; false at the end of the line
+   bool next(std::string &token) {
+      skipSpace();
+      const char *start = p;
+      while (p != end && !isSpace(*p))
+         ++p;
+      token.assign(start, p);
+      return p != start;
+   }
+
+   // consumes 'word' if it is next and not the start of a longer name or a
+   // label definition (IF:)
+   bool keyword(std::string_view word) {
+      skipSpace();
+      if (size_t(end - p) < word.size() || std::string_view(p, word.size()) != word)
+         return false;
+      const char *after = p + word.size();
+      if (after != end && !isSpace(*after) && *after != '(' && *after != ';')
+         return false;
+      p = after;
+      return true;
+   }
+
+   // consumes the directive the line starts with and returns it, with the
+   // register of @n = in 'reg'; DIRECTIVE_NONE, consuming nothing, if the
+   // line has instructions. ELSE, END and REPEAT must be alone on the line
+   int directive(std::string_view &reg) {
+      skipSpace();
+      const char *start = p;
+      if (p == end)
+         return DIRECTIVE_NONE;
+      switch (*p) {
+      case '=':
+         ++p;
+         return DIRECTIVE_PUSH;
+      case '@':
+         reg = operand();
+         if (isRegister(reg) && consume('='))
+            return DIRECTIVE_SET;
+         break;
+      case 'D':
+         if (keyword("DATA"))
+            return DIRECTIVE_DATA;
+         break;
+      case 'I':
+         if (keyword("IF"))
+            return DIRECTIVE_IF;
+         break;
+      case 'W':
+         if (keyword("WHILE"))
+            return DIRECTIVE_WHILE;
+         break;
+      case 'E':
+         if (keyword("ELSE")) {
+            if (atEnd())
+               return DIRECTIVE_ELSE;
+         } else if (keyword("END") && atEnd()) {
+            return DIRECTIVE_END;
+         }
+         break;
+      case 'R':
+         if (keyword("REPEAT") && atEnd())
+            return DIRECTIVE_REPEAT;
+         break;
+      }
+      p = start;
+      return DIRECTIVE_NONE;
+   }
+
+   // consumes 'c' if it is next
+   bool consume(char c) {
+      skipSpace();
+      if (p == end || *p != c)
+         return false;
+      ++p;
+      return true;
+   }
+
+   // the next name or number, with its '@' if it is a register (@?\w+); empty if there is none
+   std::string_view operand() {
+      skipSpace();
+      const char *start = p, *q = p;
+      if (q != end && *q == '@')
+         ++q;
+      const char *word = q;
+      while (q != end && (isalnum((unsigned char)*q) || *q == '_'))
+         ++q;
+      if (q == word)
+         return std::string_view();
+      p = q;
+      return std::string_view(start, q - start);
+   }
+
+   // true if nothing but whitespace and a comment is left
+   bool atEnd() {
+      skipSpace();
+      return p == end || *p == ';';
+   }
+
+   // the rest of the line before any comment, without surrounding whitespace
+   std::string rest() {
+      skipSpace();
+      const char *last = std::find(p, end, ';');
+      while (last != p && isSpace(last[-1]))
+         --last;
+      std::string text(p, last);
+      p = end;
+      return text;
+   }
+
+private:
+   const char *p;
+   const char *end;
+
+   static bool isSpace(char c) { return isspace((unsigned char)c); }
+
+   void skipSpace() {
+      while (p != end && isSpace(*p))
+         ++p;
+   }
+};
+
+// true if the next token on the line is an operand; doesn't consume it
+inline bool nextIsOperand(GLexer lexer) {
+   std::string token;
+   return lexer.next(token) && (isNumeric(token) || token[0] == '@');
+}
+
+inline bool isLabel(const std::string &str) {
+   return str.back() == ':';
+}
+
+inline int countUsedBytes(uint64_t value) {
+   int count = 1;
+   for (int i = sizeof(value) - 1; i >= 0; --i) {
+      uint8_t byte = (value >> (i * 8)) & 0xFF;
+      if (byte != 0) {
+         count = i + 1;  // one-based index
+         break;
+      }
+   }
+   return count;
+}
+
+// GASM program that evaluates the expression and jumps to 'label' if it is
+// false; a trailing comparison and the JF become one compare-and-branch
+// superinstruction (JFLT a b label, or JFLT label if its operands are on the
+// stack)
+inline std::string jumpIfFalse(const std::string &expr, const std::string &label) {
+   static const std::string compares[] = { "EQ", "NE", "GT", "LT", "GE", "LE" };
+   std::vector<std::string> prog = expressionToInstructions(expr);
+   bool fused = false;
+   for (const std::string &cmp : compares) {
+      if (prog.empty() || fused)
+         break;
+      std::string &last = prog.back();
+      if (last == cmp) {
+         last = "JF" + cmp + " " + label;
+         fused = true;
+      } else if (last.compare(0, cmp.size() + 2, "P" + cmp + " ") == 0) {
+         last = "JF" + cmp + last.substr(cmp.size() + 1) + " " + label;
+         fused = true;
+      }
+   }
+   if (!fused)
+      prog.push_back("JF " + label);
+   std::string result;
+   for (const std::string &instruction : prog)
+      result += instruction + " ";
+   return result;
+}
+
+// INC a, then EQ/NE/GT/LT/GE/LE @a b, then JT @1 label, on consecutive lines
+// (the end of a counted loop) become the superinstruction INCJLT a b label.
+// A label defined on the second or third line keeps them apart. 'inc' scans
+// line i; true if the three lines were fused (into line i, the others are
+// cleared)
+inline bool fuseIncrementBranch(GLexer inc, std::vector<std::string> &lines, size_t i) {
+   static const char *const compares[] = { "EQ", "NE", "GT", "LT", "GE", "LE" };
+   // INC a
+   if (i + 2 >= lines.size() || !inc.keyword("INC"))
+      return false;
+   std::string a(inc.operand());
+   if (a.empty() || a[0] == '@' || !inc.atEnd())
+      return false;
+   // cmp @a b
+   GLexer cmp(lines[i + 1]);
+   const char *const *compare = std::find_if(std::begin(compares), std::end(compares),
+                                             [&](const char *c) { return cmp.keyword(c); });
+   if (compare == std::end(compares))
+      return false;
+   std::string counter(cmp.operand()), b(cmp.operand());
+   if (counter.size() < 2 || counter[0] != '@' || b.empty() || !cmp.atEnd())
+      return false;
+   // JT @1 label
+   GLexer jt(lines[i + 2]);
+   if (!jt.keyword("JT") || jt.operand() != "@1")
+      return false;
+   std::string label(jt.operand());
+   if (label.empty() || label[0] == '@' || !jt.atEnd())
+      return false;
+   // @0 is PC, which the fused instruction doesn't have at the same place,
+   // neither as the counter nor as the bound
+   counter.erase(0, 1);
+   if (!isNumeric(a) || !isNumeric(counter) || isNumeric(label) ||
+       std::stoull(a, nullptr, 0) != std::stoull(counter, nullptr, 0) || std::stoull(a, nullptr, 0) == 0)
+      return false;
+   if (b[0] == '@' && isNumeric(b.substr(1)) && std::stoull(b.substr(1), nullptr, 0) == 0)
+      return false;
+   lines[i] = std::string("INCJ") + *compare + " " + a + " " + b + " " + label;
+   lines[i + 1].clear();
+   lines[i + 2].clear();
+   return true;
+}
+
+class GAssembler {
+public:
+
+   // assembles 'source'; false on an error, described by error() and
+   // errorLine(). The results of the last assembly are replaced
+   bool assemble(const std::string& source) {
+      std::istringstream in(source);
+      return assemble(in);
+   }
+
+   bool assemble(std::istream& in) {
+      out.clear();
+      labelRefs.clear();
+      labelLoc.clear();
+      dataRuns.clear();
+      lineMap.clear();
+      message.clear();
+      lineNumber = 0;
+      try {
+         translate(in);
+      } catch (const std::runtime_error& e) { // ours, or from expressionToGASM()
+         message = e.what();
+         out.clear();
+         return false;
+      }
+      return true;
+   }
+
+   // the bytecode
+   const std::vector<uint8_t>& code() const { return out; }
+
+   // the bytecode with the io image, labels and line map, for a container
+   GFileContents contents() const {
+      GFileContents contents;
+      contents.code = out;
+      contents.data = dataRuns;
+      for (const auto &label : labelLoc)
+         contents.symbols.push_back(GSymbol { label.first, label.second });
+      contents.lines = lineMap;
+      return contents;
+   }
+
+   GProgram program() const { return GProgram::load(contents().pack()); }
+
+   // true if the source has DATA, which raw bytecode can't hold
+   bool hasData() const { return !dataRuns.empty(); }
+
+   const std::string& error() const { return message; }
+
+   // the 1-based source line of the error; 0 if it was found at the end
+   uint32_t errorLine() const { return lineNumber; }
+
+private:
+
+   std::vector<uint8_t> out;
+
+   // every location in the code that referenced a label
+   std::map<std::string, std::vector<uint64_t>> labelRefs;
+
+   // where we found a label defined
+   std::map<std::string, uint64_t> labelLoc;
+
+   // the io image: runs of consecutive cells set by DATA (address, values)
+   std::vector<std::pair<uint64_t, std::vector<uint64_t>>> dataRuns;
+
+   // source line of each instruction
+   std::vector<GLine> lineMap;
+
+   std::string message;
+   uint32_t lineNumber = 0; // of the line being assembled
+
+   template <class... Args>
+   [[noreturn]] void fail(const Args&... args) {
+      std::ostringstream oss;
+      (oss << ... << args);
+      throw std::runtime_error(oss.str());
+   }
+
+   // the IF/ELSE/END and WHILE/REPEAT being expanded, in one assembly
+   struct Macros {
+      bool inIf = false;     // inside if
+      bool inElse = false;   // inside else branch of if
+      bool inWhile = false;  // inside while
+
+      int label = 0;         // label generator for if/while jumping
+
+      int ifEnd = 0;         // at the end of the true case, jump here
+      int ifFalse = 0;       // in case of false, jump to this
+
+      int whileStart = 0;    // start of the while loop, where the expression is (re)evaluated
+      int whileEnd = 0;      // end of the while loop ("REPEAT")
+   };
+
+   // the expression that ends the line of 'directive'
+   std::string expression(GLexer &lexer, const std::string &directive) {
+      std::string expr = lexer.rest();
+      if (expr.empty())
+         fail("ERROR: ", directive, " without an expression");
+      return expr;
+   }
+
+   void emit(const void* bytes, size_t n) {
+      out.insert(out.end(), static_cast<const uint8_t*>(bytes), static_cast<const uint8_t*>(bytes) + n);
+   }
+
+   void translate(std::istream& in) {
+      uint64_t pc = 0;
+
+      int expected = 0; // expected operands; if 0, expects opcode
+      int expected_label_distance = 0; // if > 0, expects label sometime, == 1 expected now, == 2 expected after current operand
+      uint8_t opcode = 0; // last opcode parsed
+
+      // just to declare the last-parsed-opcode iterator
+      auto opcodeIt = opcodes().find("NOP");
+
+      // FIXME/TODO: need to create a stack of these contexts
+      Macros macros;
+
+      std::vector<std::string> lines;
+      for (std::string line; std::getline(in, line); )
+         lines.push_back(line);
+
+      // first pass: process labels and generate binary code
+      for (size_t i = 0; i < lines.size(); ++i) {
+         std::string &line = lines[i];
+         ++lineNumber;
+
+         if (expected != 0) {
+            if (opcodeIt->second.second == expected) {
+               //std::cout << "line start" << std::endl;
+               out.back() |= STACK; // the last byte is the opcode
+               expected = 0;
+            } else {
+               fail("ERROR: new line started with pending expected operands: ", expected, " (original expected: ", opcodeIt->second.second, ")");
+            }
+         }
+
+         if (expected_label_distance > 0) { // never happens
+            fail("ERROR: new line started with pending expected label distance ", expected_label_distance);
+         }
+
+         // -----------------------------------------------------------------------
+         // the line is scanned once: its first word tells a macro from an
+         // instruction line, and the same lexer then reads the expression or
+         // the instruction tokens
+         // -----------------------------------------------------------------------
+
+         GLexer lexer(line);
+         std::string_view reg;
+         std::string token;
+         bool macro = true;
+
+         switch (lexer.directive(reg)) {
+
+         // DATA address value...: no code, goes into the io image
+         case DIRECTIVE_DATA: {
+            std::vector<uint64_t> values;
+            while (lexer.next(token) && token[0] != ';') {
+               if (!isNumeric(token)) {
+                  fail("ERROR: DATA value is not a number: ", token);
+               }
+               values.push_back(std::stoull(token, nullptr, 0));
+            }
+            if (values.size() < 2) {
+               fail("ERROR: DATA needs an address and values");
+            }
+            uint64_t address = values[0];
+            if (address < 3) {
+               fail("ERROR: DATA can't set PC, R or S");
+            }
+            values.erase(values.begin());
+            if (!dataRuns.empty() && dataRuns.back().first + dataRuns.back().second.size() == address)
+               dataRuns.back().second.insert(dataRuns.back().second.end(), values.begin(), values.end());
+            else
+               dataRuns.emplace_back(address, values);
+            continue;
+         }
+
+         // MACRO: @# = <expression>
+         case DIRECTIVE_SET: {
+            std::string regNum(reg.substr(1));
+            std::string exprProg = expressionToGASM(expression(lexer, "@" + regNum + " ="), false);
+
+            std::ostringstream oss;
+            oss << exprProg;
+
+            // result of exprProg in the stack, so pop it into the desired register
+            oss << "POP " << regNum << " ";
+
+            line = oss.str();
+            break;
+         }
+
+         // MACRO: = <expression>
+         case DIRECTIVE_PUSH:
+            //"= <expr>" is just the program; result value is pushed into the stack
+            line = expressionToGASM(expression(lexer, "="), false);
+            break;
+
+         // MACRO: IF
+         case DIRECTIVE_IF: {
+            std::string condition = expression(lexer, "IF");
+
+            // TODO: nesting support
+            if (macros.inIf || macros.inElse || macros.inWhile) {
+               fail("ERROR: nested if ");
+            }
+            macros.inIf = true;
+
+            //std::cout << "IF" << std::endl;
+            //std::cout << "expr: " << condition << std::endl;
+
+            std::ostringstream oss;
+
+            macros.ifFalse = macros.label++;
+            macros.ifEnd = macros.label++;
+
+            // compute the expression and jump to the false location if it is false (label; we'll figure out where it is later)
+            oss << jumpIfFalse(condition, "__IF_" + std::to_string(macros.ifFalse));
+
+            line = oss.str();
+            break;
+         }
+
+         // MACRO: ELSE
+         case DIRECTIVE_ELSE: {
+            // TODO: nesting support
+            if (!macros.inIf || macros.inElse || macros.inWhile) {
+               fail("ERROR: misplaced ELSE ");
+            }
+            macros.inIf = false;
+            macros.inElse = true;
+
+            //std::cout << "ELSE" << std::endl;
+
+            std::ostringstream oss;
+
+            // jump the true case to the end
+            oss << "JMP __IF_" << macros.ifEnd << " ";
+
+            // write the false label destination
+            oss << "__IF_" << macros.ifFalse << ": ";
+
+            line = oss.str();
+            break;
+         }
+
+         // MACRO: END
+         case DIRECTIVE_END: {
+            // TODO: nesting support
+            if (macros.inIf && macros.inElse) {
+               fail("ERROR: IF and ELSE active at same time");
+            }
+            if ((!macros.inIf && !macros.inElse) || macros.inWhile) {
+               fail("ERROR: misplaced END");
+            }
+
+            //std::cout << "END" << std::endl;
+
+            std::ostringstream oss;
+
+            if (macros.inIf) {
+               // if end
+               // write the false label destination since no else
+               oss << "__IF_" << macros.ifFalse << ": ";
+            } else {
+               // else end
+               // write the end label destination (only needed for if else end case)
+               oss << "__IF_" << macros.ifEnd << ": ";
+            }
+
+            line = oss.str();
+
+            macros.inIf = false;
+            macros.inElse = false;
+            break;
+         }
+
+         // MACRO: WHILE
+         case DIRECTIVE_WHILE: {
+            std::string condition = expression(lexer, "WHILE");
+
+            // TODO: nesting support
+            if (macros.inIf || macros.inElse || macros.inWhile) {
+               fail("ERROR: nested while ");
+            }
+            macros.inWhile = true;
+
+            //std::cout << "WHILE" << std::endl;
+            //std::cout << "expr: " << condition << std::endl;
+
+            std::ostringstream oss;
+
+            macros.whileStart = macros.label++;
+            macros.whileEnd = macros.label++;
+
+            // drop the label where we will go back to on REPEAT
+            oss << "__WHILE_" << macros.whileStart << ": ";
+
+            // compute the expression and jump to the end if it is false (label; we'll figure out where it is later)
+            oss << jumpIfFalse(condition, "__WHILE_" + std::to_string(macros.whileEnd));
+
+            line = oss.str();
+            break;
+         }
+
+         // MACRO: REPEAT
+         case DIRECTIVE_REPEAT: {
+            // TODO: nesting support
+            if (macros.inIf || macros.inElse || !macros.inWhile) {
+               fail("ERROR: misplaced REPEAT");
+            }
+            macros.inWhile = false;
+
+            //std::cout << "REPEAT" << std::endl;
+
+            std::ostringstream oss;
+
+            // jump to the expression re-evaluation point
+            oss << "JMP __WHILE_" << macros.whileStart << " ";
+
+            // drop the end of while label
+            oss << "__WHILE_" << macros.whileEnd << ": ";
+
+            line = oss.str();
+            break;
+         }
+
+         // the end of a counted loop becomes one superinstruction
+         default:
+            macro = fuseIncrementBranch(lexer, lines, i);
+         }
+
+         // a macro's line is its expansion, which is read instead
+         if (macro)
+            lexer = GLexer(line);
+
+         // -----------------------------------------------------------------------
+         // regular line tokenization (opcodes, operands, labels)
+         // -----------------------------------------------------------------------
+
+         while (lexer.next(token)) {
+            if (token[0] == ';') {
+               break; // ignore comments
+            }
+            if (isNumeric(token) || token[0] == '@') {
+
+               if (expected_label_distance == 1) {
+                  fail("ERROR: unexpected numeric operand where label was expected: ", token);
+               }
+
+               if (expected <= 0) {
+                  fail("ERROR: unexpected operand: ", token);
+               }
+
+               --expected;
+
+               // get closer to the label
+               if (expected_label_distance > 0)
+                  --expected_label_distance;
+
+               // operand: write the numeric value or register index to the binary file
+               uint64_t value;
+               bool ispointer;
+               bool isshort = false;
+               if (isNumeric(token)) {
+                  value = std::stoull(token, nullptr, 0);
+                  ispointer = false;
+               } else {
+                  // remove the '@' symbol and convert the rest to a numeric value
+                  std::string ntoken = token.substr(1);
+                  if (! isNumeric(ntoken)) {
+                     fail("ERROR: @ is not number: ", ntoken);
+                  }
+                  value = std::stoull(ntoken, nullptr, 0);
+                  ispointer = true;
+               }
+
+               int bytecount = countUsedBytes(value);
+
+               uint8_t control;
+               if (value <= MAX_SHORT_VAL) {
+                  // short value encoding
+                  control = value;
+                  control |= SHORT_VAL;
+                  isshort = true;
+               } else {
+                  control = bytecount;
+               }
+
+               if (ispointer)
+                  control |= REG_PTR;
+
+               emit(&control, sizeof(control)); // control byte (1 byte)
+               pc += sizeof(control);
+
+               if (! isshort) { // if short, the operand was taken care of by the control byte
+                  // write operand bytes
+                  emit(&value, bytecount); // little endian everything
+                  pc += bytecount;
+               }
+            } else if (isLabel(token)) {
+               // labels can be used anywhere; remove the colon from the label
+               token.pop_back();
+               labelLoc[token] = pc;
+            } else {
+               // write the opcode to the binary file
+               auto prevOpcodeIt = opcodeIt;
+               opcodeIt = opcodes().find(token);
+               if (opcodeIt != opcodes().end() && opcodeIt->second.first == OP_HOST && nextIsOperand(lexer))
+                  opcodeIt = opcodes().find("HOSTN"); // HOST n calls host function n
+               if (opcodeIt != opcodes().end()) {
+
+                  if (expected != 0) {
+                     if (prevOpcodeIt->second.second == expected) {
+                        //std::cout << "opcode start" << std::endl;
+                        out.back() |= STACK; // the last byte is the opcode
+                        expected = 0;
+                     } else {
+                        fail("ERROR: started new opcode ", token, " with pending expected operands: ", expected, " (original expected: ", prevOpcodeIt->second.second, ")");
+                     }
+                  }
+
+                  opcode = opcodeIt->second.first;
+                  expected = opcodeIt->second.second;
+                  if (isJump(opcode)) {
+                     expected_label_distance = expected; // the label is the last operand of the jump operation
+                  }
+
+                  lineMap.push_back(GLine { uint32_t(pc), lineNumber });
+                  emit(&opcode, sizeof(opcode));
+                  pc += sizeof(opcode);
+
+               } else {
+                  // assume it is a label reference
+
+                  if (expected <= 0 || expected_label_distance != 1) {
+
+                     // STACK CASE: JF/JT (and JFLT etc.) stack version, with the values to test taken from the stack,
+                     //             so we find the label immediately
+                     //
+                     if (expected > 1 && expected == opLayout(opcode).operands + 1 && opLayout(opcode | STACK).valid) {
+
+                        // they're from the stack, so don't expect the operands
+                        expected = 1;
+
+                        out.back() |= STACK; // the last byte is the opcode
+
+                     } else {
+                        fail("ERROR: unexpected possible label reference: ", token);
+                     }
+                  }
+                  --expected;
+                  expected_label_distance = 0;
+
+                  // write the placeholder reference in the code
+
+                  // the VM expects a special operand with a hardcoded (implicit) control==2 byte for jump labels (i.e. uint16_t literal constant)
+                  // pointless to do relative jumps, shortjump vs. longjump; can't do anything with 1 byte, can do everything with 2 bytes; done.
+
+                  // save the label reference for later resolution
+                  labelRefs[token].push_back(pc);
+
+                  // actual 16-bit uint label destination
+                  uint16_t placeholder = 65535;  // if we fail to fix this, it jumps to the end
+                  emit(&placeholder, sizeof(placeholder));
+                  pc += sizeof(placeholder);
+               }
+            }
+         }
+      }
+
+      lineNumber = 0; // errors from here on are about the whole source
+
+      // check for pending expected stuff after all lines
+      if (expected != 0) {
+         if (opcodeIt->second.second == expected) {
+            //std::cout << "file end" << std::endl;
+            out.back() |= STACK; // the last byte is the opcode
+            expected = 0;
+         } else {
+            fail("ERROR: input file ended with pending expected operands: ", expected, " (original expected: ", opcodeIt->second.second, ")");
+         }
+      }
+
+      // second pass: resolve label references
+      for (const auto &entry : labelRefs) {
+         const std::string &label = entry.first;
+         auto loc = labelLoc.find(label);
+         const uint64_t labelAddress = loc != labelLoc.end() ? loc->second : 0; // an undefined label jumps to 0
+
+         if (labelAddress > 65535) {
+            fail("ERROR: program too large (>65535 code bytes) for location of label: ", label);
+         }
+
+         uint16_t laddr = (uint16_t)labelAddress;
+
+         for (uint64_t pcLocation : entry.second) {
+
+            // overwrite the placeholder with the real label address
+            memcpy(&out[pcLocation], &laddr, sizeof(laddr));
+         }
+      }
+   }
+};
+
+#endif
@@ -0,0 +1,344 @@
+/*
+  GBENCH
+
+  Benchmark for the GVM execution engines.
+
+  Runs each bytecode file given on the command line repeatedly with every
+  engine, with a reset() of the VM before each run, and reports the
+  average time per executed instruction.
+
+  The bench*.g files are loop kernels meant for this; the prog*.g samples are
+  short enough that they mostly measure the per-run setup cost.
+
+  The native engine is only measured for files that have gvm2c output built
+  next to them (prog.so for prog.b).
+
+  With -j N, it instead measures the throughput of a GExecutor running the
+  file as many separate jobs, with 1, 2, 4... up to N worker threads.
+
+  With -a N, it measures the assembler instead: GAssembler assembling a
+  generated source of N megabytes (straight-line code, expressions, DATA,
+  labels and IF/WHILE macros).
+
+  With -f N, it measures fork(): a VM restores a snapshot, writes one cell in
+  each of 0, 1, 2, 4... up to N of its io pages and forks into a child with
+  the same base, which only copies the lines written; the last line is a
+  fork() into a new VM, which copies all of io.
+*/
+
+#include "gasm.hpp"
+#include "gexec.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <chrono>
+#include <string>
+
+// the check policy of the BasicGVM an Engine runs on
+enum : uint8_t {
+   CHECKS,    // GVM
+   NO_CHECKS, // GVMNoChecks
+   MASKED,    // GVMMaskedChecks
+   GUARDED    // GVMGuardedChecks, on a GGuardedIo
+};
+
+struct Engine {
+   const char* name;
+   uint8_t     engine;
+   uint8_t     limitMode;
+   bool        verify;   // run verify() first, for the unchecked interpreter
+   uint8_t     checks;
+};
+
+const Engine engines[] = {
+   { "switch",   ENGINE_SWITCH,  LIMIT_EXACT, false, CHECKS    },
+   { "interp",   ENGINE_INTERP,  LIMIT_EXACT, false, CHECKS    },
+   { "masked",   ENGINE_INTERP,  LIMIT_EXACT, false, MASKED    },
+#if GVM_GUARD
+   { "guarded",  ENGINE_INTERP,  LIMIT_EXACT, false, GUARDED   },
+#endif
+   { "verified", ENGINE_INTERP,  LIMIT_EXACT, true,  CHECKS    },
+   { "nochecks", ENGINE_INTERP,  LIMIT_EXACT, true,  NO_CHECKS },
+   { "decoded",  ENGINE_DECODED, LIMIT_EXACT, false, CHECKS    },
+   { "blocks",   ENGINE_DECODED, LIMIT_BLOCK, false, CHECKS    },
+   { "quick",    ENGINE_QUICK,   LIMIT_EXACT, false, CHECKS    },
+#if GVM_JIT
+   { "jit",      ENGINE_JIT,     LIMIT_EXACT, false, CHECKS    },
+#endif
+#if GVM_NATIVE
+   { "native",   ENGINE_NATIVE,  LIMIT_EXACT, false, CHECKS    },
+#endif
+};
+
+GVM::memory_t io;
+
+template <class VM>
+void measure(const std::string& filename, const GProgram& program, const Engine& e, double seconds, uint64_t limit,
+             typename VM::memory_t& io = ::io) {
+   VM vm(io, program, []() {});
+   vm.setEngine(e.engine);
+   vm.setLimitMode(e.limitMode);
+   if (e.verify && !vm.verify())
+      return;
+   if (e.engine == ENGINE_NATIVE) {
+      // gvm2c output for prog.b is expected in prog.so
+      std::string so = filename.substr(0, filename.rfind('.')) + ".so";
+      if (!vm.loadNative(so.c_str()))
+         return;
+   }
+   uint64_t runs = 0;
+   uint64_t instructions = 0;
+   auto start = std::chrono::steady_clock::now();
+   double elapsed = 0;
+   do {
+      vm.reset();
+      vm.run(limit);
+      instructions += vm.count;
+      ++runs;
+      elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+   } while (elapsed < seconds);
+   std::cout << std::left << std::setw(16) << filename << std::setw(9) << e.name << std::right
+             << " term=" << vm.term
+             << " runs=" << std::setw(9) << runs
+             << " ops/run=" << std::setw(9) << vm.count
+             << std::fixed << std::setprecision(2)
+             << " ns/op=" << std::setw(7) << (elapsed * 1e9 / instructions)
+             << " Mops/s=" << std::setw(8) << (instructions / elapsed / 1e6)
+             << std::endl;
+}
+
+void bench(const std::string& filename, const GProgram& program, double seconds, uint64_t limit) {
+   for (const Engine& e : engines) {
+      switch (e.checks) {
+      case NO_CHECKS:
+         measure<BasicGVM<IO_SIZE, REG_SIZE, GVMNoChecks>>(filename, program, e, seconds, limit);
+         break;
+      case MASKED:
+         measure<BasicGVM<IO_SIZE, REG_SIZE, GVMMaskedChecks>>(filename, program, e, seconds, limit);
+         break;
+#if GVM_GUARD
+      case GUARDED: {
+         GGuardedIo<IO_SIZE> guarded;
+         if (guarded.ok())
+            measure<BasicGVM<IO_SIZE, REG_SIZE, GVMGuardedChecks>>(filename, program, e, seconds, limit, guarded.io());
+         break;
+      }
+#endif
+      default:
+         measure<GVM>(filename, program, e, seconds, limit);
+      }
+   }
+}
+
+// jobs per worker in each batch of throughput(): enough to keep every worker
+// busy while the batch drains
+const size_t BATCH = 16;
+
+void throughput(const std::string& filename, const GProgram& program, double seconds, uint64_t limit, unsigned maxWorkers) {
+   std::vector<unsigned> counts;
+   for (unsigned workers = 1; workers < maxWorkers; workers *= 2)
+      counts.push_back(workers);
+   counts.push_back(maxWorkers);
+   double base = 0;
+   for (unsigned workers : counts) {
+      GExecutor executor(workers);
+      std::atomic<uint64_t> instructions { 0 };
+      uint64_t jobs = 0;
+      std::atomic<uint64_t> term { 0 };
+      auto start = std::chrono::steady_clock::now();
+      double elapsed = 0;
+      do {
+         for (size_t i = 0; i < BATCH * workers; ++i)
+            executor.submit({ program, {}, limit }, [&](const GExecutor::Result& r) {
+               instructions += r.count;
+               term = r.term;
+            });
+         executor.wait();
+         jobs += BATCH * workers;
+         elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      } while (elapsed < seconds);
+      double rate = instructions / elapsed / 1e6;
+      if (workers == 1)
+         base = rate;
+      std::cout << std::left << std::setw(16) << filename << std::right
+                << " workers=" << std::setw(3) << workers
+                << " term=" << term
+                << " jobs/s=" << std::setw(10) << uint64_t(jobs / elapsed)
+                << std::fixed << std::setprecision(2)
+                << " Mops/s=" << std::setw(8) << rate
+                << " speedup=" << std::setw(5) << rate / base
+                << std::endl;
+   }
+}
+
+// blocks of GASM with every kind of line; the first ones also have loops and
+// IF/WHILE macros, the rest are straight-line, so that the labels stay in the
+// first 64K of code
+const size_t BRANCHING_BLOCKS = 256;
+
+std::string generateSource(size_t bytes) {
+   std::ostringstream source;
+   for (size_t i = 0; size_t(source.tellp()) < bytes; ++i) {
+      source << "; block " << i << "\n"
+             << "@10 = @3 + " << i << " * 2\n"
+             << "@11 = (@10 - 1) * (@4 + 3)   ; expression\n"
+             << "   = @11 % 7\n"
+             << "POP 12\n"
+             << "DATA " << 100 + i % 1000 * 4 << " " << i << " 1 2 3\n";
+      if (i < BRANCHING_BLOCKS) {
+         source << "IF @12 > @10\n"
+                << "   SET 13 " << i << "\n"
+                << "ELSE\n"
+                << "   SUB @10 1\n"
+                << "   POP 13\n"
+                << "END\n"
+                << "SET 14 0\n"
+                << "WHILE @14 < 3\n"
+                << "   INC 14\n"
+                << "REPEAT\n"
+                << "loop" << i << ":\n"
+                << "INC 15\n"
+                << "LT @15 10\n"
+                << "JT @1 loop" << i << "\n";
+      } else {
+         source << "SET 13 " << i << "\n"
+                << "\tADD @13 3\n"
+                << "POP 14\n"
+                << "MUL @14 @14   ; square\n"
+                << "POP 15\n";
+      }
+   }
+   source << "TERM\n";
+   return source.str();
+}
+
+void assembleBench(size_t megabytes, double seconds) {
+   std::string source = generateSource(megabytes << 20);
+   size_t lines = std::count(source.begin(), source.end(), '\n');
+   GAssembler assembler;
+   uint64_t runs = 0;
+   auto start = std::chrono::steady_clock::now();
+   double elapsed = 0;
+   do {
+      if (!assembler.assemble(source)) {
+         std::cerr << "line " << assembler.errorLine() << ": " << assembler.error() << std::endl;
+         return;
+      }
+      ++runs;
+      elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+   } while (elapsed < seconds);
+   std::cout << std::left << std::setw(16) << "assemble" << std::right
+             << " bytes=" << std::setw(9) << source.size()
+             << " lines=" << std::setw(8) << lines
+             << " code=" << std::setw(8) << assembler.code().size()
+             << " runs=" << std::setw(5) << runs
+             << std::fixed << std::setprecision(2)
+             << " ms/run=" << std::setw(8) << (elapsed * 1e3 / runs)
+             << " MB/s=" << std::setw(7) << (source.size() * runs / elapsed / (1 << 20))
+             << std::endl;
+}
+
+GVM::memory_t childIo;
+
+void forkBench(uint64_t maxPages, double seconds) {
+   GVM parent(io, GProgram());
+   GVM child(childIo, GProgram());
+   parent.reset();
+   GVM::Snapshot base = parent.snapshot();
+   child.restore(base);
+   maxPages = std::min(maxPages, GVM::Snapshot::PAGES);
+   for (uint64_t pages = 0; pages <= maxPages; pages = pages ? pages * 2 : 1) {
+      uint64_t runs = 0;
+      auto start = std::chrono::steady_clock::now();
+      double elapsed = 0;
+      do {
+         parent.restore(base);
+         for (uint64_t page = 0; page < pages; ++page) {
+            uint64_t cell = page * GVM::Snapshot::PAGE_SIZE + REG_SIZE;
+            parent.io[cell] = runs;
+            parent.touch(cell);
+         }
+         parent.fork(child);
+         if (++runs % 256)
+            continue;
+         elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      } while (elapsed < seconds);
+      std::cout << std::left << std::setw(16) << "restore+fork" << std::right
+                << " pages=" << std::setw(4) << pages
+                << " runs=" << std::setw(9) << runs
+                << std::fixed << std::setprecision(2)
+                << " ns/run=" << std::setw(8) << (elapsed * 1e9 / runs)
+                << std::endl;
+      if (!pages && !maxPages)
+         break;
+   }
+   uint64_t runs = 0;
+   auto start = std::chrono::steady_clock::now();
+   double elapsed = 0;
+   do {
+      parent.fork(childIo);
+      ++runs;
+      elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+   } while (elapsed < seconds);
+   std::cout << std::left << std::setw(16) << "fork new VM" << std::right
+             << " pages=" << std::setw(4) << GVM::Snapshot::PAGES
+             << " runs=" << std::setw(9) << runs
+             << std::fixed << std::setprecision(2)
+             << " ns/run=" << std::setw(8) << (elapsed * 1e9 / runs)
+             << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+   double seconds = 0.5;
+   uint64_t limit = 1000000000;
+   unsigned workers = 0;
+   size_t megabytes = 0;
+   int64_t forkPages = -1;
+   int first = 1;
+   while (first + 1 < argc && argv[first][0] == '-') {
+      std::string opt = argv[first];
+      if (opt == "-t")
+         seconds = std::stod(argv[first + 1]);
+      else if (opt == "-l")
+         limit = std::stoull(argv[first + 1]);
+      else if (opt == "-j")
+         workers = std::stoul(argv[first + 1]);
+      else if (opt == "-a")
+         megabytes = std::stoul(argv[first + 1]);
+      else if (opt == "-f")
+         forkPages = std::stoll(argv[first + 1]);
+      else
+         break;
+      first += 2;
+   }
+   if (megabytes) {
+      assembleBench(megabytes, seconds);
+      return 0;
+   }
+   if (forkPages >= 0) {
+      forkBench(forkPages, seconds);
+      return 0;
+   }
+   if (first >= argc) {
+      std::cerr << "Usage: " << argv[0] << " [-t seconds] [-l oplimit] [-j workers] <filename>..." << std::endl;
+      std::cerr << "       " << argv[0] << " [-t seconds] -a megabytes" << std::endl;
+      std::cerr << "       " << argv[0] << " [-t seconds] -f pages" << std::endl;
+      return 1;
+   }
+
+   for (int i = first; i < argc; ++i) {
+      std::string error;
+      GProgram program = GProgram::open(argv[i], &error);
+      if (!program) {
+         std::cerr << "Error opening file: " << error << std::endl;
+         return 1;
+      }
+      if (workers)
+         throughput(argv[i], program, seconds, limit, workers);
+      else
+         bench(argv[i], program, seconds, limit);
+   }
+
+   return 0;
+}
@@ -4,7 +4,13 @@
   Disassembler for GVM bytecode.
 
   This takes one parameter, which is an input GASM bytecode file, and writes to
-  stdout a GASM program that can be compiled to that bytecode.
+  stdout a GASM program that can be compiled to that bytecode. For a container
+  written by gasm, the listing also has its io image (as DATA lines), its
+  labels and the source line of each instruction (in comments).
+
+  An optional second parameter is a profile written by gvm --profile; each
+  instruction is then annotated with its execution count and cycles in a
+  comment, and each CALL target with its calls and inclusive cycles.
 */
 
 #include "gvm.hpp"
@@ -15,23 +21,96 @@
 #include <map>
 #include <cstring>
 #include <iomanip>
+#include <sstream>
+
+// counters of a gvm --profile report
+struct Profile {
+   uint64_t cycles = 0;
+   std::map<uint64_t, std::pair<uint64_t, uint64_t>> ops;   // opcode --> (count, cycles)
+   std::map<uint64_t, std::pair<uint64_t, uint64_t>> pcs;   // address --> (count, cycles)
+   std::map<uint64_t, std::pair<uint64_t, uint64_t>> calls; // target --> (calls, inclusive cycles)
+
+   bool load(const char* filename) {
+      std::ifstream file(filename);
+      if (!file.is_open())
+         return false;
+      std::string line;
+      while (std::getline(file, line)) {
+         std::istringstream iss(line);
+         std::string kind;
+         uint64_t key, count, c;
+         if (!(iss >> kind >> key >> count >> c))
+            continue; // the header comment
+         if (kind == "op")
+            ops[key] = { count, c };
+         else if (kind == "pc") {
+            pcs[key] = { count, c };
+            cycles += c;
+         } else if (kind == "call")
+            calls[key] = { count, c };
+      }
+      return true;
+   }
+
+   static std::string percent(uint64_t part, uint64_t total) {
+      std::ostringstream oss;
+      oss << std::fixed << std::setprecision(1) << (total ? 100.0 * part / total : 0.0) << "%";
+      return oss.str();
+   }
+};
 
 class GDisassembler {
 public:
-   std::vector<uint8_t>& code;
+   const GProgram& program;
+   GView<uint8_t> code;
    uint64_t pc;
+   const Profile* profile = nullptr;
 
-   GDisassembler(std::vector<uint8_t>& code) : code(code), pc(0) {}
+   GDisassembler(const GProgram& program) : program(program), code(program.bytes()), pc(0) {}
 
    void disassemble() {
+      for (const GDataRun& run : program.ioImage()) {
+         for (size_t i = 0; i < run.values.size(); i += 8) {
+            std::cout << "DATA " << run.address + i;
+            for (size_t j = i; j < i + 8 && j < run.values.size(); ++j)
+               std::cout << " " << run.values[j];
+            std::cout << std::endl;
+         }
+      }
+      std::multimap<uint64_t, std::string> symbols;
+      for (const GSymbol& sym : program.symbols())
+         symbols.emplace(sym.address, sym.name);
+      uint32_t line = 0;
       pc = 0;
       while (pc < code.size()) {
+         start = pc;
+         uint32_t source = program.sourceLine(pc);
+         if (source != line) {
+            std::cout << "; line " << source << std::endl;
+            line = source;
+         }
+         auto names = symbols.equal_range(pc);
+         for (auto it = names.first; it != names.second; ++it)
+            std::cout << it->second << ": ";
+         if (profile) {
+            auto it = profile->calls.find(pc);
+            if (it != profile->calls.end())
+               std::cout << "; called " << it->second.first << " times, " << it->second.second << " cycles inclusive ("
+                         << Profile::percent(it->second.second, profile->cycles) << ")" << std::endl;
+         }
          std::cout << "L" << std::setfill('0') << std::setw(5) << pc << std::setfill(' ') << std::setw(0) << ": ";
          uint8_t opcode = code[pc++];
 
          bool stk = opcode & STACK; // stk will modify the expected operands
          opcode &= ~STACK; // get rid of STACK bit to simplify case
 
+         // PUSHED superinstructions are the binary opcodes with a "P" prefix (PADD)
+         std::string p;
+         if (!stk && (opcode & PUSHED) && opLayout(opcode).valid) {
+            opcode &= ~PUSHED;
+            p = "P";
+         }
+
          switch (opcode) {
          case OP_NOP:
             disasm("NOP", 0);
@@ -46,37 +125,37 @@ public:
             disasm("JMP", 1, true);
             break;
          case OP_ADD:
-            disasm("ADD", stk ? 0 : 2);
+            disasm(p + "ADD", stk ? 0 : 2);
             break;
          case OP_SUB:
-            disasm("SUB", stk ? 0 : 2);
+            disasm(p + "SUB", stk ? 0 : 2);
             break;
          case OP_MUL:
-            disasm("MUL", stk ? 0 : 2);
+            disasm(p + "MUL", stk ? 0 : 2);
             break;
          case OP_DIV:
-            disasm("DIV", stk ? 0 : 2);
+            disasm(p + "DIV", stk ? 0 : 2);
             break;
          case OP_MOD:
-            disasm("MOD", stk ? 0 : 2);
+            disasm(p + "MOD", stk ? 0 : 2);
             break;
          case OP_OR:
-            disasm("OR", stk ? 0 : 2);
+            disasm(p + "OR", stk ? 0 : 2);
             break;
          case OP_ANDL:
             disasm("ANDL", stk ? 0 : 2);
             break;
          case OP_XOR:
-            disasm("XOR", stk ? 0 : 2);
+            disasm(p + "XOR", stk ? 0 : 2);
             break;
          case OP_NOT:
             disasm("NOT", stk ? 0 : 1);
             break;
          case OP_SHL:
-            disasm("SHL", stk ? 0 : 2);
+            disasm(p + "SHL", stk ? 0 : 2);
             break;
          case OP_SHR:
-            disasm("SHR", stk ? 0 : 2);
+            disasm(p + "SHR", stk ? 0 : 2);
             break;
          case OP_INC:
             disasm("INC", 1);
@@ -91,11 +170,14 @@ public:
             disasm("POP", 1);
             break;
          case OP_AND:
-            disasm("AND", stk ? 0 : 2);
+            disasm(p + "AND", stk ? 0 : 2);
             break;
          case OP_HOST:
             disasm("HOST", 0);
             break;
+         case OP_HOSTN:
+            disasm(stk ? "HOSTN" : "HOST", stk ? 0 : 1); // bare HOST is OP_HOST
+            break;
          case OP_VPUSH:
             disasm("VPUSH", 2);
             break;
@@ -115,38 +197,88 @@ public:
             disasm("JF", stk ? 1 : 2, true); // SHOULD work: value to test is stk, label is still expected (so 1 instead of 0)
             break;
          case OP_EQ:
-            disasm("EQ", stk ? 0 : 2);
+            disasm(p + "EQ", stk ? 0 : 2);
             break;
          case OP_NE:
-            disasm("NE", stk ? 0 : 2);
+            disasm(p + "NE", stk ? 0 : 2);
             break;
          case OP_GT:
-            disasm("GT", stk ? 0 : 2);
+            disasm(p + "GT", stk ? 0 : 2);
             break;
          case OP_LT:
-            disasm("LT", stk ? 0 : 2);
+            disasm(p + "LT", stk ? 0 : 2);
             break;
          case OP_GE:
-            disasm("GE", stk ? 0 : 2);
+            disasm(p + "GE", stk ? 0 : 2);
             break;
          case OP_LE:
-            disasm("LE", stk ? 0 : 2);
+            disasm(p + "LE", stk ? 0 : 2);
             break;
          case OP_NEG:
             disasm("NEG", stk ? 0 : 1);
             break;
          case OP_ORL:
-            disasm("ORL", stk ? 0 : 2);
+            disasm(p + "ORL", stk ? 0 : 2);
+            break;
+         case OP_JFEQ:
+            disasm("JFEQ", stk ? 1 : 3, true);
+            break;
+         case OP_JFNE:
+            disasm("JFNE", stk ? 1 : 3, true);
+            break;
+         case OP_JFGT:
+            disasm("JFGT", stk ? 1 : 3, true);
+            break;
+         case OP_JFLT:
+            disasm("JFLT", stk ? 1 : 3, true);
+            break;
+         case OP_JFGE:
+            disasm("JFGE", stk ? 1 : 3, true);
+            break;
+         case OP_JFLE:
+            disasm("JFLE", stk ? 1 : 3, true);
+            break;
+         case OP_INCJEQ:
+            disasm("INCJEQ", 3, true);
+            break;
+         case OP_INCJNE:
+            disasm("INCJNE", 3, true);
+            break;
+         case OP_INCJGT:
+            disasm("INCJGT", 3, true);
+            break;
+         case OP_INCJLT:
+            disasm("INCJLT", 3, true);
+            break;
+         case OP_INCJGE:
+            disasm("INCJGE", 3, true);
+            break;
+         case OP_INCJLE:
+            disasm("INCJLE", 3, true);
             break;
          default:
             std::cout << "UNKNOWN_OPCODE_" << int(opcode) << std::endl;
             break;
          }
       }
+      // labels at the end of the code
+      auto names = symbols.equal_range(code.size());
+      for (auto it = names.first; it != names.second; ++it)
+         std::cout << it->second << ":" << std::endl;
+   }
+
+   // per-opcode totals of the profile, as comments
+   void summary() {
+      std::cout << "; opcode  count  cycles" << std::endl;
+      for (const auto& op : profile->ops)
+         std::cout << "; " << op.first << "  " << op.second.first << "  " << op.second.second << " ("
+                   << Profile::percent(op.second.second, profile->cycles) << ")" << std::endl;
    }
 
 private:
 
+   uint64_t start = 0; // address of the instruction being disassembled
+
    uint64_t read(bool& is_pointer, bool jump_skip_control = false) {
       is_pointer = false;
       if (pc >= code.size()) {
@@ -188,46 +320,51 @@ private:
    // if isjump, the last operand expected (in count) is the jump
    void disasm(const std::string& operation, int count, bool isjump = false) {
       std::cout << operation << " ";
-      bool pop1, pop2;
-      uint64_t op1, op2;
-      if (count >= 1) {
-         bool op1_is_jump = (isjump && count == 1);
-         op1 = read(pop1,op1_is_jump);
-         if (op1_is_jump) {
-            std::cout << "L" << std::setfill('0') << std::setw(5) << prop(pop1,op1) << std::setfill(' ') << std::setw(0) << " ";
+      for (int i = 0; i < count; ++i) {
+         bool is_pointer;
+         bool is_jump = isjump && i == count - 1;
+         uint64_t op = read(is_pointer, is_jump);
+         if (is_jump) {
+            std::cout << "L" << std::setfill('0') << std::setw(5) << prop(is_pointer,op) << std::setfill(' ') << std::setw(0) << " ";
          } else {
-            std::cout << prop(pop1,op1) << " ";
-         }
-         if (count >= 2) {
-            op2 = read(pop2,isjump);
-            if (isjump) {
-               std::cout << "L" << std::setfill('0') << std::setw(5) << prop(pop2,op2) << std::setfill(' ') << std::setw(0) << " ";
-            } else {
-               std::cout << prop(pop2,op2) << " ";
-            }
+            std::cout << prop(is_pointer,op) << " ";
          }
       }
+      if (profile) {
+         auto it = profile->pcs.find(start);
+         if (it != profile->pcs.end())
+            std::cout << "; " << it->second.first << "x " << it->second.second << " cycles ("
+                      << Profile::percent(it->second.second, profile->cycles) << ")";
+      }
       std::cout << std::endl;
    }
 };
 
 int main(int argc, char* argv[]) {
-   if (argc != 2) {
-      std::cerr << "Usage: " << argv[0] << " <filename>" << std::endl;
+   if (argc != 2 && argc != 3) {
+      std::cerr << "Usage: " << argv[0] << " <filename> [profile]" << std::endl;
+      return 1;
+   }
+
+   std::string error;
+   GProgram program = GProgram::open(argv[1], &error);
+   if (!program) {
+      std::cerr << "Error opening file: " << error << std::endl;
       return 1;
    }
 
-   const char* filename = argv[1];
-   std::ifstream file(filename, std::ios::binary);
-   if (!file.is_open()) {
-      std::cerr << "Error opening file: " << filename << std::endl;
+   Profile profile;
+   if (argc == 3 && !profile.load(argv[2])) {
+      std::cerr << "Error opening file: " << argv[2] << std::endl;
       return 1;
    }
-   std::vector<uint8_t> code(std::istreambuf_iterator<char>(file), {});
-   file.close();
 
-   GDisassembler disassembler(code);
+   GDisassembler disassembler(program);
+   if (argc == 3)
+      disassembler.profile = &profile;
    disassembler.disassemble();
+   if (argc == 3)
+      disassembler.summary();
 
    return 0;
 }
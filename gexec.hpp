@@ -0,0 +1,255 @@
+/*
+  GEXEC
+
+  Executor for running many independent GVM programs on a pool of threads.
+
+  A job is a program (shared between the jobs that run it), the initial
+  values of the first io cells and an op limit. Each worker thread owns one
+  VM, set up once by the 'setup' function given to the executor (engine,
+  host callback, host functions), and runs its jobs on it one after the
+  other: reset() clears what the last job wrote before each job, and the code
+  is only replaced when the program changes, so consecutive jobs of the same
+  program keep its quickened or compiled form. The bytecode and its decoded
+  form are not copied per worker: all workers share them through the
+  GProgram.
+
+  Every worker has its own deque of jobs. submit() deals jobs to the deques
+  round-robin; a worker takes its newest job first, and when its deque is
+  empty it steals the oldest job of another worker. The deques are locked
+  per worker, so workers only contend when one steals from another. The
+  number of jobs waiting in the deques is an atomic counter that workers
+  claim jobs from; the executor's own lock is only taken by a worker that
+  finds nothing to claim and goes to sleep, and by submit() when there is a
+  sleeping worker to wake.
+
+  The result of a job (term, count, last opcode and the final io) goes to the
+  job's callback, on the worker thread, which reads io from the worker's VM,
+  or to the future returned by submit(), which gets a copy of it.
+*/
+
+#ifndef GEXEC_HPP
+#define GEXEC_HPP
+
+#include "gvm.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+template <class VM = GVM>
+class BasicGExecutor {
+   static_assert(VM::Checks::addressing != IO_GUARDED, "the workers' io has no guard pages");
+
+public:
+
+   struct Job {
+      GProgram              program;
+      std::vector<uint64_t> io;                        // copied to io[0..], the rest of io is 0
+      uint64_t              limit = DEFAULT_OP_LIMIT;  // passed to run()
+   };
+
+   // what a callback gets; 'io' is the worker's, valid until the callback returns
+   struct Result {
+      uint64_t                             term;
+      uint64_t                             count;
+      uint8_t                              opcode;
+      const uint64_t*                      io;     // final io, registers included
+   };
+
+   // what the future of submit() gets: a Result with its own copy of io
+   struct Outcome {
+      uint64_t                             term;
+      uint64_t                             count;
+      uint8_t                              opcode;
+      std::array<uint64_t, VM::IO_SIZE>    io;
+   };
+
+   typedef std::function<void(const Result& result)> Callback;
+   typedef std::function<void(VM& vm)> Setup;
+
+   // starts 'workers' threads (0: one per core); 'setup' is called on each
+   // worker's VM before it runs any job (HOST does nothing unless it sets a
+   // host callback)
+   BasicGExecutor(unsigned workers = 0, const Setup& setup = nullptr) {
+      if (workers == 0)
+         workers = std::max(1u, std::thread::hardware_concurrency());
+      for (unsigned i = 0; i < workers; ++i) {
+         pool.emplace_back(new Worker());
+         pool.back()->vm.setHostCallback([] {});
+         if (setup)
+            setup(pool.back()->vm);
+      }
+      for (unsigned i = 0; i < workers; ++i)
+         pool[i]->thread = std::thread(&BasicGExecutor::work, this, i);
+   }
+
+   BasicGExecutor(const BasicGExecutor&) = delete;
+   BasicGExecutor& operator=(const BasicGExecutor&) = delete;
+
+   // finishes the jobs already submitted
+   ~BasicGExecutor() {
+      wait();
+      {
+         std::lock_guard<std::mutex> lock(idleLock);
+         stopping = true;
+      }
+      wake.notify_all();
+      for (auto& w : pool)
+         w->thread.join();
+   }
+
+   size_t workers() const { return pool.size(); }
+
+   // queues 'job'; 'done' is called with its result on the worker thread
+   void submit(Job job, Callback done) {
+      Worker& w = *pool[next++ % pool.size()];
+      ++unfinished;
+      {
+         std::lock_guard<std::mutex> lock(w.lock);
+         w.tasks.push_back(Task { std::move(job), std::move(done) });
+      }
+      ++queued;
+      if (sleeping > 0) {
+         // a worker that saw no job is in wake.wait() once this has the lock
+         std::lock_guard<std::mutex> lock(idleLock);
+         wake.notify_one();
+      }
+   }
+
+   std::future<Outcome> submit(Job job) {
+      auto promise = std::make_shared<std::promise<Outcome>>();
+      std::future<Outcome> result = promise->get_future();
+      submit(std::move(job), [promise](const Result& r) {
+         Outcome outcome;
+         outcome.term = r.term;
+         outcome.count = r.count;
+         outcome.opcode = r.opcode;
+         std::memcpy(outcome.io.data(), r.io, sizeof(uint64_t) * VM::IO_SIZE);
+         promise->set_value(outcome);
+      });
+      return result;
+   }
+
+   // blocks until every submitted job has completed
+   void wait() {
+      std::unique_lock<std::mutex> lock(idleLock);
+      finished.wait(lock, [this] { return unfinished == 0; });
+   }
+
+private:
+
+   struct Task {
+      Job      job;
+      Callback done;
+   };
+
+   struct Worker {
+      std::mutex               lock;     // guards tasks
+      std::deque<Task>         tasks;
+      std::thread              thread;
+      typename VM::memory_t    io;
+      VM                       vm { io, GProgram() };
+   };
+
+   std::vector<std::unique_ptr<Worker>> pool;
+   std::atomic<size_t>                  next { 0 };       // worker of the next submit()
+   std::atomic<size_t>                  unfinished { 0 }; // submitted and not completed
+
+   std::atomic<size_t>                  queued { 0 };     // jobs in the deques that no worker has claimed
+   std::atomic<size_t>                  sleeping { 0 };   // workers in wake.wait()
+
+   std::mutex                           idleLock;         // guards stopping; sleeping changes under it
+   std::condition_variable              wake;             // a job was queued, or stopping
+   std::condition_variable              finished;         // unfinished reached 0
+   bool                                 stopping = false;
+
+   // takes one of the queued jobs, if there is one
+   bool claim() {
+      size_t n = queued;
+      while (n > 0)
+         if (queued.compare_exchange_weak(n, n - 1))
+            return true;
+      return false;
+   }
+
+   // the newest job of worker 'self', or else the oldest job of another worker
+   bool take(size_t self, Task& task) {
+      {
+         Worker& w = *pool[self];
+         std::lock_guard<std::mutex> lock(w.lock);
+         if (!w.tasks.empty()) {
+            task = std::move(w.tasks.back());
+            w.tasks.pop_back();
+            return true;
+         }
+      }
+      for (size_t i = 1; i < pool.size(); ++i) {
+         Worker& victim = *pool[(self + i) % pool.size()];
+         std::lock_guard<std::mutex> lock(victim.lock);
+         if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return true;
+         }
+      }
+      return false;
+   }
+
+   void work(size_t self) {
+      Worker& w = *pool[self];
+      Task task;
+      for (;;) {
+         if (!claim()) {
+            // submit() counts the job before it looks for sleepers, and this
+            // counts itself as sleeping before it looks for jobs, so one of
+            // the two sees the other
+            std::unique_lock<std::mutex> lock(idleLock);
+            ++sleeping;
+            wake.wait(lock, [this] { return queued > 0 || stopping; });
+            --sleeping;
+            if (queued == 0)
+               return;
+            continue;
+         }
+         // each claim matches one job in some deque
+         while (!take(self, task))
+            std::this_thread::yield();
+         Result result;
+         execute(w, task.job, result);
+         task.done(result);
+         task = Task();
+         if (--unfinished == 0) {
+            std::lock_guard<std::mutex> lock(idleLock);
+            finished.notify_all();
+         }
+      }
+   }
+
+   void execute(Worker& w, const Job& job, Result& result) {
+      VM& vm = w.vm;
+      if (vm.program != job.program)
+         vm.setProgram(job.program);
+      vm.reset();
+      size_t inputs = std::min<size_t>(job.io.size(), VM::IO_SIZE);
+      std::memcpy(&(w.io[0]), job.io.data(), sizeof(uint64_t) * inputs);
+      vm.touch(0, inputs);
+      vm.run(job.limit);
+      result.term = vm.term;
+      result.count = vm.count;
+      result.opcode = vm.opcode;
+      result.io = &(w.io[0]);
+   }
+};
+
+typedef BasicGExecutor<> GExecutor;
+
+#endif
@@ -0,0 +1,152 @@
+/*
+  GGUARD
+
+  Guard-page io for GVMs with IO_GUARDED addressing (see GVMGuardedChecks).
+
+  GGuardedIo maps the io array so that it ends on a page boundary and is
+  followed by an inaccessible reservation that covers every 32-bit cell
+  index. The VM truncates addresses to 32 bits and accesses io without
+  comparing them with IO_SIZE: an address beyond io faults in the guard,
+  and the SIGSEGV handler installed by GGuard jumps back to the run that was
+  executing on the faulting thread (a GGuard::Scope), which ends it with
+  ERR_SEGFAULT. Faults anywhere else go to the handler that was installed
+  before.
+
+  The io of a VM with IO_GUARDED addressing must come from a GGuardedIo; a
+  plain array has no guard behind it.
+*/
+
+#ifndef GGUARD_HPP
+#define GGUARD_HPP
+
+#include <cstdint>
+
+#if (defined(__linux__) || defined(__APPLE__)) && UINTPTR_MAX > 0xFFFFFFFFu
+#define GVM_GUARD 1
+#else
+#define GVM_GUARD 0
+#endif
+
+#if GVM_GUARD
+
+#include <setjmp.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cstddef>
+#include <mutex>
+
+class GGuard {
+public:
+
+   // bytes of guard behind io: every 32-bit cell index lands in io or in it
+   static constexpr size_t RESERVED = (size_t(1) << 32) * sizeof(uint64_t);
+
+   // a guarded run on this thread: a fault in [begin, begin + RESERVED)
+   // jumps to 'jump'; scopes nest, and the innermost one gets the fault
+   class Scope {
+   public:
+      Scope(sigjmp_buf* jump, const void* begin)
+         : jump(jump), begin(static_cast<const char*>(begin)), previous(current()) {
+         install();
+         current() = this;
+      }
+      Scope(const Scope&) = delete;
+      Scope& operator=(const Scope&) = delete;
+      ~Scope() { current() = previous; }
+
+   private:
+      friend class GGuard;
+      sigjmp_buf* jump;
+      const char* begin;
+      Scope*      previous;
+   };
+
+private:
+
+   static Scope*& current() {
+      static thread_local Scope* scope = nullptr;
+      return scope;
+   }
+
+   static struct sigaction& chained() {
+      static struct sigaction action;
+      return action;
+   }
+
+   // SA_NODEFER: the handler leaves with siglongjmp() and doesn't restore
+   // the signal mask, so SIGSEGV must not stay blocked
+   static void install() {
+      static std::once_flag once;
+      std::call_once(once, [] {
+         struct sigaction action = {};
+         action.sa_sigaction = &handler;
+         action.sa_flags = SA_SIGINFO | SA_NODEFER | SA_ONSTACK;
+         sigemptyset(&action.sa_mask);
+         sigaction(SIGSEGV, &action, &chained());
+#if defined(__APPLE__)
+         sigaction(SIGBUS, &action, nullptr); // macOS reports PROT_NONE accesses as SIGBUS
+#endif
+      });
+   }
+
+   static void handler(int sig, siginfo_t* info, void* context) {
+      const char* addr = static_cast<const char*>(info->si_addr);
+      Scope* scope = current();
+      if (scope && addr >= scope->begin && addr < scope->begin + RESERVED)
+         siglongjmp(*scope->jump, 1);
+      // not a guarded run: let the previous handler have it, or restore the
+      // default action so that the fault happens again without us
+      const struct sigaction& previous = chained();
+      if (previous.sa_flags & SA_SIGINFO)
+         previous.sa_sigaction(sig, info, context);
+      else if (previous.sa_handler != SIG_DFL && previous.sa_handler != SIG_IGN)
+         previous.sa_handler(sig);
+      else
+         signal(sig, SIG_DFL);
+   }
+};
+
+// io of IoSize cells in front of a GGuard::RESERVED guard
+template <uint64_t IoSize>
+class GGuardedIo {
+public:
+
+   typedef uint64_t memory_t[IoSize];
+
+   GGuardedIo() {
+      size_t page = size_t(sysconf(_SC_PAGESIZE));
+      size_t bytes = (IoSize * sizeof(uint64_t) + page - 1) / page * page;
+      size = bytes + GGuard::RESERVED;
+      void* p = mmap(nullptr, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+      if (p == MAP_FAILED)
+         return;
+      if (mprotect(p, bytes, PROT_READ | PROT_WRITE) != 0) {
+         munmap(p, size);
+         return;
+      }
+      mapping = static_cast<char*>(p);
+      cells = reinterpret_cast<memory_t*>(mapping + bytes - IoSize * sizeof(uint64_t));
+   }
+
+   GGuardedIo(const GGuardedIo&) = delete;
+   GGuardedIo& operator=(const GGuardedIo&) = delete;
+   ~GGuardedIo() {
+      if (mapping)
+         munmap(mapping, size);
+   }
+
+   // false if the reservation couldn't be mapped
+   bool ok() const { return mapping != nullptr; }
+
+   memory_t& io() { return *cells; }
+
+private:
+   char*     mapping = nullptr;
+   size_t    size = 0;
+   memory_t* cells = nullptr;
+};
+
+#endif
+
+#endif
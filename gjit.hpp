@@ -0,0 +1,568 @@
+/*
+  GJIT
+
+  Baseline x86-64 template JIT for the GVM (ENGINE_JIT).
+
+  Each basic block of the decoded program (see GVM::decode()) is translated
+  to native code the first time execution reaches it, and the block is then
+  entered directly from the dispatch loop in run().
+
+  Inside a block:
+    - PC is not kept anywhere: it is a constant for each instruction, so @0
+      reads were already folded by the decoder and PC is only stored on exit
+    - R (io[1]) and S (io[2]) live in r15 and r14
+    - the op count lives in r12 and is checked before every instruction, so
+      'count' and ERR_OPLIMIT match the interpreter exactly
+    - io addresses are checked inline: constant addresses at compile time,
+      computed addresses with a compare against IO_SIZE
+
+  Instructions without a native template (stack ops and the PUSHED and
+  STACK superinstructions, DIV/MOD, shifts, CALL, RET, HOST, VPUSH/VPOP,
+  anything that could fault or write PC...) call back
+  into the VM through GVMNativeContext::step, which runs them with GVM::step(),
+  so every ERR_* code comes from the same code paths as in the interpreter.
+
+  Register use: rbx = io, rbp = GVMNativeContext*, r12 = count, r14 = S,
+  r15 = R. rax and rcx are scratch.
+*/
+
+#ifndef GJIT_HPP
+#define GJIT_HPP
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__))
+#define GVM_JIT 1
+#else
+#define GVM_JIT 0
+#endif
+
+#if GVM_JIT
+
+#include <sys/mman.h>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+class GJit {
+public:
+
+   GJit() {}
+   GJit(const GJit&) = delete;
+   GJit& operator=(const GJit&) = delete;
+   ~GJit() { flush(); }
+
+   // drops all compiled code
+   void flush() {
+      for (const auto& chunk : chunks)
+         munmap(chunk.first, chunk.second);
+      chunks.clear();
+      chunkUsed = 0;
+      blocks.clear();
+      written.clear();
+      writesAnywhere = false;
+   }
+
+   // adds the io lines (see IO_LINE) that compiled code can write to 'dirty',
+   // or sets 'all' if it has stores to computed addresses
+   void markWrites(bool* dirty, bool& all) const {
+      if (writesAnywhere) {
+         all = true;
+         return;
+      }
+      for (size_t i = 0; i < written.size(); ++i)
+         dirty[i] = dirty[i] || written[i];
+   }
+
+   template <class VM>
+   void run(VM& vm, uint64_t limit) {
+      if (vm.decodedIndex.size() != vm.code.size() || epoch != vm.decodeEpoch) {
+         if (vm.decodedIndex.size() != vm.code.size())
+            vm.decode();
+         flush();
+         epoch = vm.decodeEpoch;
+      }
+      if (blocks.size() != vm.code.size())
+         blocks.assign(vm.code.size(), nullptr);
+
+      GVMNativeContext ctx;
+      ctx.io = &(vm.io[0]);
+      ctx.count = vm.count;
+      ctx.limit = limit;
+      ctx.term = vm.term;
+      ctx.opcode = vm.opcode;
+      ctx.vm = &vm;
+      ctx.step = &VM::nativeStep;
+
+      while (!ctx.term && vm.PC < vm.code.size()) {
+         uint64_t pc = vm.PC;
+         void* block = blocks[pc];
+         if (!block && vm.locate(pc) != VM::DECODED_NONE)
+            block = blocks[pc] = compile(vm, pc);
+         if (!block) {
+            // not at an instruction boundary (or out of executable memory)
+            if (++ctx.count > limit) {
+               ctx.term = ERR_OPLIMIT;
+               break;
+            }
+            vm.step();
+            ctx.term = vm.term;
+            ctx.opcode = vm.opcode;
+            continue;
+         }
+         reinterpret_cast<void (*)(GVMNativeContext*)>(block)(&ctx);
+      }
+
+      vm.count = ctx.count;
+      vm.term = ctx.term;
+      vm.opcode = ctx.opcode;
+   }
+
+private:
+
+   static constexpr size_t CHUNK_SIZE = 1 << 16;
+   static constexpr size_t MAX_BLOCK = 128; // instructions per block
+
+   enum : uint8_t { RAX = 0, RCX = 1, RBX = 3, RSP = 4, RBP = 5, RDI = 7, R12 = 12, R14 = 14, R15 = 15 };
+   enum : uint8_t { CC_B = 2, CC_AE = 3, CC_E = 4, CC_NE = 5, CC_BE = 6, CC_A = 7 };
+   enum : uint8_t { ALU_ADD = 0x01, ALU_OR = 0x09, ALU_AND = 0x21, ALU_SUB = 0x29, ALU_XOR = 0x31, ALU_CMP = 0x39 };
+
+   // out-of-line block exit, emitted after the block body
+   struct Exit {
+      size_t   patch;   // rel32 to patch with the address of the exit code
+      uint64_t pc;      // value stored in PC
+      int      opcode;  // value stored in 'opcode', or -1 to leave it
+      uint64_t term;    // value stored in 'term' (0 = leave it)
+      bool     count;   // increment the op count (ERR_OPLIMIT exit)
+   };
+
+   std::vector<std::pair<uint8_t*, size_t>> chunks;
+   size_t                                   chunkUsed = 0;
+   std::vector<void*>                       blocks;
+   uint64_t                                 epoch = 0;
+
+   std::vector<uint8_t>                     buf;
+   std::vector<Exit>                        exits;
+   std::vector<size_t>                      toEpilogue;
+   uint64_t                                 ioSize = IO_SIZE; // of the VM being compiled
+   std::vector<uint8_t>                     written;          // per io line: compiled code stores to it
+   bool                                     writesAnywhere = false; // compiled code stores to computed addresses
+
+   // --- x86-64 encoding ------------------------------------------------------
+
+   void byte(uint8_t b) { buf.push_back(b); }
+
+   void imm32(uint32_t v) {
+      for (int i = 0; i < 4; ++i)
+         byte(v >> (8 * i));
+   }
+
+   void imm64(uint64_t v) {
+      for (int i = 0; i < 8; ++i)
+         byte(v >> (8 * i));
+   }
+
+   void rex(bool w, uint8_t reg, uint8_t base) {
+      uint8_t r = 0x40 | (w ? 8 : 0) | ((reg & 8) ? 4 : 0) | ((base & 8) ? 1 : 0);
+      if (r != 0x40)
+         byte(r);
+   }
+
+   // [base + disp32] addressing (base must not be rsp or r12)
+   void mem(uint8_t reg, uint8_t base, int32_t disp) {
+      byte(0x80 | ((reg & 7) << 3) | (base & 7));
+      imm32(disp);
+   }
+
+   void movImm(uint8_t r, uint64_t v) {
+      if (v <= UINT32_MAX) {
+         rex(false, 0, r);
+         byte(0xB8 + (r & 7));
+         imm32(v);
+      } else {
+         rex(true, 0, r);
+         byte(0xB8 + (r & 7));
+         imm64(v);
+      }
+   }
+
+   void movRR(uint8_t dst, uint8_t src) { rex(true, src, dst); byte(0x89); byte(0xC0 | ((src & 7) << 3) | (dst & 7)); }
+   void load(uint8_t dst, uint8_t base, int32_t disp) { rex(true, dst, base); byte(0x8B); mem(dst, base, disp); }
+   void store(uint8_t base, int32_t disp, uint8_t src) { rex(true, src, base); byte(0x89); mem(src, base, disp); }
+   void storeImm(uint8_t base, int32_t disp, uint64_t v) { rex(true, 0, base); byte(0xC7); mem(0, base, disp); imm32(v); } // sign-extended
+   void alu(uint8_t op, uint8_t dst, uint8_t src) { rex(true, src, dst); byte(op); byte(0xC0 | ((src & 7) << 3) | (dst & 7)); }
+   void imul(uint8_t dst, uint8_t src) { rex(true, dst, src); byte(0x0F); byte(0xAF); byte(0xC0 | ((dst & 7) << 3) | (src & 7)); }
+   void cmpImm(uint8_t r, uint32_t v) { rex(true, 0, r); byte(0x81); byte(0xF8 | (r & 7)); imm32(v); }
+   void test(uint8_t r) { alu(0x85, r, r); }
+   void setcc(uint8_t cc, uint8_t r8) { byte(0x0F); byte(0x90 + cc); byte(0xC0 | r8); }
+   void movzxAl() { byte(0x0F); byte(0xB6); byte(0xC0); }
+   void incDec(bool inc, uint8_t r) { rex(true, 0, r); byte(0xFF); byte((inc ? 0xC0 : 0xC8) | (r & 7)); }
+   void incDecMem(bool inc, int32_t disp) { wrote(disp / 8); rex(true, 0, RBX); byte(0xFF); mem(inc ? 0 : 1, RBX, disp); }
+   void incDecIndexed(bool inc) { writesAnywhere = true; byte(0x48); byte(0xFF); byte(inc ? 0x04 : 0x0C); byte(0xCB); } // [rbx + rcx*8]
+   void storeIndexed() { writesAnywhere = true; byte(0x48); byte(0x89); byte(0x04); byte(0xCB); }                     // [rbx + rcx*8] = rax
+   void push(uint8_t r) { rex(false, 0, r); byte(0x50 + (r & 7)); }
+   void pop(uint8_t r) { rex(false, 0, r); byte(0x58 + (r & 7)); }
+
+   // jumps with a rel32 to be patched; return the patch offset
+   size_t jcc(uint8_t cc) { byte(0x0F); byte(0x80 + cc); imm32(0); return buf.size() - 4; }
+   size_t jmp() { byte(0xE9); imm32(0); return buf.size() - 4; }
+
+   void patch(size_t at, size_t target) {
+      int32_t rel = int32_t(target) - int32_t(at + 4);
+      memcpy(&buf[at], &rel, 4);
+   }
+
+   void exitTo(size_t patchAt, uint64_t pc, int opcode, uint64_t term = 0, bool count = false) {
+      exits.push_back({ patchAt, pc, opcode, term, count });
+   }
+
+   // condition code of the unsigned comparison EQ, NE, GT, LT, GE or LE,
+   // given as an offset from the first one (the superinstructions follow
+   // the same order)
+   static uint8_t compareCC(int cmp) {
+      static const uint8_t cc[] = { CC_E, CC_NE, CC_A, CC_B, CC_AE, CC_BE };
+      return cc[cmp];
+   }
+
+   // --- operands ---------------------------------------------------------------
+
+   bool nativeOperand(uint64_t value, bool ptr) const { return !ptr || value < ioSize; }
+
+   void loadOperand(uint8_t r, uint64_t value, bool ptr) {
+      if (!ptr)
+         movImm(r, value);
+      else if (value == 1)
+         movRR(r, R15);
+      else if (value == 2)
+         movRR(r, R14);
+      else
+         load(r, RBX, value * 8);
+   }
+
+   // spill R and S, run the instruction at 'pc' through GVM::step() and reload
+   void callStep(uint64_t pc) {
+      storeImm(RBX, 0, pc);
+      store(RBX, 8, R15);
+      store(RBX, 16, R14);
+      movRR(RDI, RBP);
+      byte(0xFF); mem(2, RBP, offsetof(GVMNativeContext, step)); // call [rbp + step]
+      load(R15, RBX, 8);
+      load(R14, RBX, 16);
+   }
+
+   // after callStep(): leave the block if the instruction failed or jumped
+   void checkStep(uint64_t next) {
+      rex(true, 0, RBP); byte(0x83); mem(7, RBP, offsetof(GVMNativeContext, term)); byte(0); // cmp [rbp + term], 0
+      toEpilogue.push_back(jcc(CC_NE));
+      load(RAX, RBX, 0);
+      cmpImm(RAX, next);
+      toEpilogue.push_back(jcc(CC_NE));
+   }
+
+   // computed io address in rcx: leave for the step path unless 3 <= rcx < ioSize
+   void checkAddress(std::vector<std::pair<size_t, size_t>>& slow, size_t index) {
+      cmpImm(RCX, ioSize);
+      slow.push_back({ jcc(CC_AE), index });
+      cmpImm(RCX, 3);
+      slow.push_back({ jcc(CC_B), index });
+   }
+
+   // records a store to io cell 'addr' for markWrites()
+   void wrote(uint64_t addr) {
+      written.resize((ioSize + IO_LINE - 1) / IO_LINE);
+      written[addr / IO_LINE] = 1;
+   }
+
+   // store rax to a constant io address
+   void storeConst(uint64_t addr) {
+      if (addr == 1) {
+         movRR(R15, RAX);
+      } else if (addr == 2) {
+         movRR(R14, RAX);
+      } else {
+         wrote(addr);
+         store(RBX, addr * 8, RAX);
+      }
+   }
+
+   // --- blocks -----------------------------------------------------------------
+
+   template <class VM>
+   void* compile(VM& vm, uint64_t pc) {
+      buf.clear();
+      exits.clear();
+      toEpilogue.clear();
+      ioSize = VM::IO_SIZE;
+
+      // prologue: 5 pushes keep the stack 16-byte aligned for the step calls
+      push(RBX); push(RBP); push(R12); push(R14); push(R15);
+      movRR(RBP, RDI);
+      load(RBX, RBP, offsetof(GVMNativeContext, io));
+      load(R12, RBP, offsetof(GVMNativeContext, count));
+      load(R15, RBX, 8);
+      load(R14, RBX, 16);
+
+      // instructions whose native fast path bails out to the step path
+      std::vector<std::pair<size_t, size_t>> slow; // (rel32 patch, decoded index)
+      std::vector<size_t> resume(vm.decoded.size() + 1, 0);
+
+      int lastOpcode = -1; // last opcode executed natively, if known
+      uint32_t ip = vm.locate(pc);
+      bool open = true;    // falls through to the next instruction
+      size_t n = 0;
+      uint64_t next = pc;
+      while (open && ip < vm.decoded.size() && n < MAX_BLOCK) {
+         const typename VM::Instr& in = vm.decoded[ip];
+         next = in.next;
+         bool p1 = in.kind & VM::IN_PTR1;
+         bool p2 = in.kind & VM::IN_PTR2;
+
+         // op limit: same check as the interpreter, before the instruction
+         rex(true, R12, RBP); byte(0x3B); mem(R12, RBP, offsetof(GVMNativeContext, limit)); // cmp r12, [rbp + limit]
+         exitTo(jcc(CC_AE), in.pc, lastOpcode, ERR_OPLIMIT, true);
+         incDec(true, R12);
+
+         bool native = true;
+         uint8_t op = in.opcode;
+         switch (op) {
+         case OP_NOP:
+            break;
+         case OP_TERM:
+            exitTo(jmp(), UINT64_MAX, op);
+            open = false;
+            break;
+         case OP_JMP:
+            exitTo(jmp(), in.op1, op);
+            open = false;
+            break;
+         case OP_SET:
+            if (!nativeOperand(in.op2, p2) || !nativeOperand(in.op1, p1) || (!p1 && (in.op1 == 0 || in.op1 >= ioSize))) {
+               native = false;
+               break;
+            }
+            loadOperand(RAX, in.op2, p2);
+            if (p1) {
+               loadOperand(RCX, in.op1, true);
+               checkAddress(slow, ip);
+               storeIndexed();
+            } else {
+               storeConst(in.op1);
+            }
+            break;
+         case OP_INC:
+         case OP_DEC:
+            if (!nativeOperand(in.op1, p1) || (!p1 && (in.op1 == 0 || in.op1 >= ioSize))) {
+               native = false;
+               break;
+            }
+            if (p1) {
+               loadOperand(RCX, in.op1, true);
+               checkAddress(slow, ip);
+               incDecIndexed(op == OP_INC);
+            } else if (in.op1 == 1) {
+               incDec(op == OP_INC, R15);
+            } else if (in.op1 == 2) {
+               incDec(op == OP_INC, R14);
+            } else {
+               incDecMem(op == OP_INC, in.op1 * 8);
+            }
+            break;
+         case OP_ADD:
+         case OP_SUB:
+         case OP_MUL:
+         case OP_AND:
+         case OP_OR:
+         case OP_XOR:
+         case OP_EQ:
+         case OP_NE:
+         case OP_GT:
+         case OP_LT:
+         case OP_GE:
+         case OP_LE:
+         case OP_ANDL:
+         case OP_ORL:
+            if (!nativeOperand(in.op1, p1) || !nativeOperand(in.op2, p2)) {
+               native = false;
+               break;
+            }
+            loadOperand(RAX, in.op1, p1);
+            loadOperand(RCX, in.op2, p2);
+            switch (op) {
+            case OP_ADD: alu(ALU_ADD, RAX, RCX); break;
+            case OP_SUB: alu(ALU_SUB, RAX, RCX); break;
+            case OP_MUL: imul(RAX, RCX); break;
+            case OP_AND: alu(ALU_AND, RAX, RCX); break;
+            case OP_OR:  alu(ALU_OR, RAX, RCX); break;
+            case OP_XOR: alu(ALU_XOR, RAX, RCX); break;
+            case OP_ANDL:
+            case OP_ORL:
+               test(RAX);
+               setcc(CC_NE, RAX);
+               test(RCX);
+               setcc(CC_NE, RCX);
+               byte(op == OP_ANDL ? 0x20 : 0x08); byte(0xC8); // and/or al, cl
+               movzxAl();
+               break;
+            default:
+               alu(ALU_CMP, RAX, RCX);
+               setcc(compareCC(op - OP_EQ), RAX);
+               movzxAl();
+            }
+            if (op == OP_SUB && VM::Checks::negNum) {
+               // mov does not touch the borrow from the sub
+               movRR(R15, RAX);
+               exitTo(jcc(CC_B), in.next, op, ERR_NEGNUM);
+            } else {
+               movRR(R15, RAX);
+            }
+            break;
+         case OP_NOT:
+         case OP_NEG:
+            if (!nativeOperand(in.op1, p1)) {
+               native = false;
+               break;
+            }
+            loadOperand(RAX, in.op1, p1);
+            if (op == OP_NOT) {
+               test(RAX);
+               setcc(CC_E, RAX);
+               movzxAl();
+            } else {
+               byte(0x48); byte(0xF7); byte(0xD0); // not rax
+            }
+            movRR(R15, RAX);
+            break;
+         case OP_JT:
+         case OP_JF:
+            if (!nativeOperand(in.op1, p1)) {
+               native = false;
+               break;
+            }
+            loadOperand(RAX, in.op1, p1);
+            test(RAX);
+            exitTo(jcc(op == OP_JT ? CC_NE : CC_E), in.op2, op);
+            break;
+         case OP_JFEQ:
+         case OP_JFNE:
+         case OP_JFGT:
+         case OP_JFLT:
+         case OP_JFGE:
+         case OP_JFLE:
+            if (!nativeOperand(in.op1, p1) || !nativeOperand(in.op2, p2)) {
+               native = false;
+               break;
+            }
+            loadOperand(RAX, in.op1, p1);
+            loadOperand(RCX, in.op2, p2);
+            alu(ALU_CMP, RAX, RCX);
+            exitTo(jcc(compareCC(op - OP_JFEQ) ^ 1), in.addr, op); // inverted condition
+            break;
+         case OP_INCJEQ:
+         case OP_INCJNE:
+         case OP_INCJGT:
+         case OP_INCJLT:
+         case OP_INCJGE:
+         case OP_INCJLE:
+            if (p1 || in.op1 == 0 || in.op1 >= ioSize || !nativeOperand(in.op2, p2)) {
+               native = false;
+               break;
+            }
+            if (in.op1 == 1)
+               incDec(true, R15);
+            else if (in.op1 == 2)
+               incDec(true, R14);
+            else
+               incDecMem(true, in.op1 * 8);
+            loadOperand(RAX, in.op1, true);
+            loadOperand(RCX, in.op2, p2);
+            alu(ALU_CMP, RAX, RCX);
+            // setcc, movzx and mov leave the flags of the cmp alone
+            setcc(compareCC(op - OP_INCJEQ), RAX);
+            movzxAl();
+            movRR(R15, RAX);
+            exitTo(jcc(compareCC(op - OP_INCJEQ)), in.addr, op);
+            break;
+         default:
+            native = false;
+         }
+
+         if (native) {
+            lastOpcode = op;
+         } else {
+            callStep(in.pc);
+            lastOpcode = -1;
+            if (op == OP_CALL || op == OP_RET || op == VM::OP_SLOW) {
+               // always leaves (or fails): PC is already in io[0]
+               toEpilogue.push_back(jmp());
+               open = false;
+            } else {
+               checkStep(in.next);
+            }
+         }
+         resume[ip] = buf.size();
+         ++ip;
+         ++n;
+      }
+      if (open)
+         exitTo(jmp(), next, lastOpcode);
+
+      // slow paths: the native code bailed out before changing any state
+      for (const auto& s : slow) {
+         const typename VM::Instr& in = vm.decoded[s.second];
+         patch(s.first, buf.size());
+         callStep(in.pc);
+         checkStep(in.next);
+         size_t j = jmp();
+         patch(j, resume[s.second]);
+      }
+
+      // exits
+      for (const Exit& e : exits) {
+         patch(e.patch, buf.size());
+         if (e.count)
+            incDec(true, R12);
+         storeImm(RBX, 0, e.pc);
+         if (e.opcode >= 0)
+            storeImm(RBP, offsetof(GVMNativeContext, opcode), e.opcode);
+         if (e.term)
+            storeImm(RBP, offsetof(GVMNativeContext, term), e.term);
+         toEpilogue.push_back(jmp());
+      }
+
+      // epilogue
+      size_t epilogue = buf.size();
+      for (size_t at : toEpilogue)
+         patch(at, epilogue);
+      store(RBX, 8, R15);
+      store(RBX, 16, R14);
+      store(RBP, offsetof(GVMNativeContext, count), R12);
+      pop(R15); pop(R14); pop(R12); pop(RBP); pop(RBX);
+      byte(0xC3); // ret
+
+      return install();
+   }
+
+   // copies 'buf' to executable memory
+   void* install() {
+      if (buf.size() > CHUNK_SIZE)
+         return nullptr;
+      if (chunks.empty() || chunkUsed + buf.size() > CHUNK_SIZE) {
+         void* mem = mmap(nullptr, CHUNK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+         if (mem == MAP_FAILED)
+            return nullptr;
+         chunks.push_back({ static_cast<uint8_t*>(mem), CHUNK_SIZE });
+         chunkUsed = 0;
+      } else if (mprotect(chunks.back().first, CHUNK_SIZE, PROT_READ | PROT_WRITE) != 0) {
+         return nullptr;
+      }
+      uint8_t* code = chunks.back().first + chunkUsed;
+      memcpy(code, buf.data(), buf.size());
+      chunkUsed += (buf.size() + 15) & ~size_t(15);
+      if (mprotect(chunks.back().first, CHUNK_SIZE, PROT_READ | PROT_EXEC) != 0)
+         return nullptr;
+      return code;
+   }
+};
+
+#endif // GVM_JIT
+
+#endif // GJIT_HPP
@@ -0,0 +1,109 @@
+/*
+  GNATIVE
+
+  Loader for ahead-of-time compiled GVM programs (ENGINE_NATIVE).
+
+  gvm2c translates a bytecode file to a C source file, which is then compiled
+  to a shared object:
+
+    gvm2c prog.b prog.c
+    cc -O2 -shared -fPIC prog.c -o prog.so
+
+  The shared object exports the entry point and the facts it was built
+  against: the GVMNativeContext ABI version, IO_SIZE, and the size and hash
+  (codeHash()) of the bytecode. open() refuses a shared object that doesn't
+  match the code it is given, so a stale .so can't run next to an updated .b;
+  the GVM then keeps interpreting the bytecode.
+
+  The generated code keeps the same instruction count, ERR_* codes and final
+  state as the interpreter, calling back into the VM (GVMNativeContext::step)
+  for the instructions it doesn't compile.
+*/
+
+#ifndef GNATIVE_HPP
+#define GNATIVE_HPP
+
+#if defined(__unix__) || defined(__APPLE__)
+#define GVM_NATIVE 1
+#else
+#define GVM_NATIVE 0
+#endif
+
+#if GVM_NATIVE
+
+#include <dlfcn.h>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+class GNative {
+public:
+
+   typedef void (*entry_t)(GVMNativeContext*);
+
+   GNative() {}
+   GNative(const GNative&) = delete;
+   GNative& operator=(const GNative&) = delete;
+   ~GNative() { close(); }
+
+   // loads the shared object at 'path' if it was compiled for this io size,
+   // from a program with this size and hash; returns false (and stays closed) otherwise
+   bool open(const char* path, uint64_t ioCells, uint64_t codeSize, uint64_t hash) {
+      close();
+      // a bare file name is a file in the current directory, not a library to search for
+      std::string file = strchr(path, '/') ? path : std::string("./") + path;
+      handle = dlopen(file.c_str(), RTLD_NOW | RTLD_LOCAL);
+      if (!handle)
+         return false;
+      const uint64_t* abi = static_cast<const uint64_t*>(dlsym(handle, "gvm_native_abi"));
+      const uint64_t* ioSize = static_cast<const uint64_t*>(dlsym(handle, "gvm_native_io_size"));
+      const uint64_t* size = static_cast<const uint64_t*>(dlsym(handle, "gvm_native_code_size"));
+      const uint64_t* h = static_cast<const uint64_t*>(dlsym(handle, "gvm_native_hash"));
+      void* run = dlsym(handle, "gvm_native_run");
+      if (!abi || !ioSize || !size || !h || !run ||
+          *abi != NATIVE_ABI || *ioSize != ioCells || *size != codeSize || *h != hash) {
+         close();
+         return false;
+      }
+      entry = reinterpret_cast<entry_t>(run);
+      this->codeSize = codeSize;
+      return true;
+   }
+
+   void close() {
+      if (handle)
+         dlclose(handle);
+      handle = nullptr;
+      entry = nullptr;
+      codeSize = 0;
+   }
+
+   // true if a shared object is loaded for code of this size
+   bool loaded(uint64_t size) const { return entry && codeSize == size; }
+
+   template <class VM>
+   void run(VM& vm, uint64_t limit) {
+      GVMNativeContext ctx;
+      ctx.io = &(vm.io[0]);
+      ctx.count = vm.count;
+      ctx.limit = limit;
+      ctx.term = vm.term;
+      ctx.opcode = vm.opcode;
+      ctx.vm = &vm;
+      ctx.step = &VM::nativeStep;
+      entry(&ctx);
+      vm.count = ctx.count;
+      vm.term = ctx.term;
+      vm.opcode = ctx.opcode;
+   }
+
+private:
+
+   void*    handle = nullptr;
+   entry_t  entry = nullptr;
+   uint64_t codeSize = 0;
+};
+
+#endif // GVM_NATIVE
+
+#endif // GNATIVE_HPP
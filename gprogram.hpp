@@ -0,0 +1,436 @@
+/*
+  GPROGRAM
+
+  Immutable, shared GVM programs.
+
+  A GProgram is a reference-counted handle on a program's bytecode: copying
+  it copies a pointer, and any number of VMs, on any number of threads, can
+  run the same bytes. GProgram::open() maps a bytecode file read-only
+  (one mmap, with the pages read in as the program touches them) where the
+  platform has mmap, and reads it into memory elsewhere.
+
+  A program also keeps what VMs derive from its bytecode, such as the decoded
+  form and the verify() result (see derived()), so that it is computed by the
+  first VM that needs it and shared by all the others.
+
+  A bytecode file is either raw bytecode or a container (what gasm writes):
+
+    GFileHeader      magic "\x7FGVM", version, number of sections
+    GFileSection[]   type, offset and size of each section
+    sections         each at an offset that is a multiple of 8
+
+  with the sections
+
+    GSECTION_CODE     the bytecode
+    GSECTION_DATA     initial io contents, as runs of cells: { uint64_t
+                      address, uint64_t count, uint64_t values[count] }...
+    GSECTION_SYMBOLS  the labels: { uint32_t address, uint32_t length,
+                      char name[length] }... (not aligned)
+    GSECTION_LINES    source line of each instruction: GLine[], by pc
+    GSECTION_META     metadata cached by tools; the loader only keeps it
+
+  All numbers are little-endian. 0x7F is not an opcode, so raw bytecode never
+  starts with the magic. Sections of other types are skipped, and a file of a
+  later version is refused.
+
+  GView is a read-only view of an array, used by the VM for its code and for
+  derived tables it doesn't own.
+*/
+
+#ifndef GPROGRAM_HPP
+#define GPROGRAM_HPP
+
+#if defined(__unix__) || defined(__APPLE__)
+#define GVM_MMAP 1
+#else
+#define GVM_MMAP 0
+#endif
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <typeindex>
+#include <utility>
+#include <vector>
+
+#if GVM_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// read-only view of 'size' elements at 'data'; the elements must outlive it
+template <class T>
+class GView {
+public:
+   GView() = default;
+   GView(const T* data, size_t size) : first(data), length(size) {}
+   GView(const std::vector<T>& v) : first(v.data()), length(v.size()) {}
+
+   const T* data() const { return first; }
+   size_t size() const { return length; }
+   bool empty() const { return length == 0; }
+
+   const T& operator[](size_t i) const { return first[i]; }
+   const T& back() const { return first[length - 1]; }
+   const T* begin() const { return first; }
+   const T* end() const { return first + length; }
+
+private:
+   const T* first = nullptr;
+   size_t   length = 0;
+};
+
+const char     GFILE_MAGIC[4] = { 0x7F, 'G', 'V', 'M' };
+const uint16_t GFILE_VERSION = 1;
+
+enum {
+   GSECTION_CODE    = 1,
+   GSECTION_DATA    = 2,
+   GSECTION_SYMBOLS = 3,
+   GSECTION_LINES   = 4,
+   GSECTION_META    = 5,
+};
+
+struct GFileHeader {
+   char     magic[4];
+   uint16_t version;
+   uint16_t sections;  // GFileSections following the header
+   uint64_t reserved;  // 0
+};
+
+struct GFileSection {
+   uint32_t type;      // GSECTION_*
+   uint32_t reserved;  // 0
+   uint64_t offset;    // from the start of the file
+   uint64_t size;      // in bytes
+};
+
+// a run of initialized io cells
+struct GDataRun {
+   uint64_t         address;
+   GView<uint64_t>  values;
+};
+
+struct GSymbol {
+   std::string name;
+   uint64_t    address;
+};
+
+struct GLine {
+   uint32_t pc;    // address of an instruction
+   uint32_t line;  // 1-based line in the source
+};
+
+// the contents of a container, for writing one
+struct GFileContents {
+   std::vector<uint8_t>                                     code;
+   std::vector<std::pair<uint64_t, std::vector<uint64_t>>>  data;     // address, values
+   std::vector<GSymbol>                                     symbols;
+   std::vector<GLine>                                       lines;    // by pc
+   std::vector<uint8_t>                                     meta;
+
+   std::vector<uint8_t> pack() const {
+      std::vector<std::pair<uint32_t, std::vector<uint8_t>>> sections;
+      auto append = [](std::vector<uint8_t>& out, const void* p, size_t n) {
+         out.insert(out.end(), static_cast<const uint8_t*>(p), static_cast<const uint8_t*>(p) + n);
+      };
+      sections.emplace_back(GSECTION_CODE, code);
+      if (!data.empty()) {
+         std::vector<uint8_t> out;
+         for (const auto& run : data) {
+            uint64_t head[2] = { run.first, run.second.size() };
+            append(out, head, sizeof(head));
+            append(out, run.second.data(), run.second.size() * sizeof(uint64_t));
+         }
+         sections.emplace_back(GSECTION_DATA, std::move(out));
+      }
+      if (!symbols.empty()) {
+         std::vector<uint8_t> out;
+         for (const GSymbol& sym : symbols) {
+            uint32_t head[2] = { uint32_t(sym.address), uint32_t(sym.name.size()) };
+            append(out, head, sizeof(head));
+            append(out, sym.name.data(), sym.name.size());
+         }
+         sections.emplace_back(GSECTION_SYMBOLS, std::move(out));
+      }
+      if (!lines.empty()) {
+         std::vector<uint8_t> out;
+         append(out, lines.data(), lines.size() * sizeof(GLine));
+         sections.emplace_back(GSECTION_LINES, std::move(out));
+      }
+      if (!meta.empty())
+         sections.emplace_back(GSECTION_META, meta);
+
+      GFileHeader header = {};
+      memcpy(header.magic, GFILE_MAGIC, 4);
+      header.version = GFILE_VERSION;
+      header.sections = uint16_t(sections.size());
+      std::vector<uint8_t> file;
+      append(file, &header, sizeof(header));
+      uint64_t offset = sizeof(header) + sections.size() * sizeof(GFileSection);
+      for (const auto& sec : sections) {
+         offset = (offset + 7) & ~uint64_t(7);
+         GFileSection entry = { sec.first, 0, offset, sec.second.size() };
+         append(file, &entry, sizeof(entry));
+         offset += sec.second.size();
+      }
+      for (const auto& sec : sections) {
+         file.resize((file.size() + 7) & ~size_t(7), 0);
+         append(file, sec.second.data(), sec.second.size());
+      }
+      return file;
+   }
+};
+
+class GProgram {
+public:
+
+   // no program: 0 bytes of code
+   GProgram() = default;
+
+   // a program of a copy of 'bytes'
+   explicit GProgram(std::vector<uint8_t> bytes) : image(std::make_shared<Image>()) {
+      image->owned = std::move(bytes);
+      image->bytes = GView<uint8_t>(image->owned);
+   }
+
+   // the program in 'file', a container or raw bytecode; a null program if
+   // the container is malformed, with the reason in 'error' (if given)
+   static GProgram load(std::vector<uint8_t> file, std::string* error = nullptr) {
+      GProgram program;
+      program.image = std::make_shared<Image>();
+      program.image->owned = std::move(file);
+      if (!program.image->parse(GView<uint8_t>(program.image->owned), error))
+         return GProgram();
+      return program;
+   }
+
+   // the bytecode file at 'path', mapped read-only; a null program if it
+   // can't be read, with the reason in 'error' (if given)
+   static GProgram open(const char* path, std::string* error = nullptr) {
+      GProgram program;
+      auto fail = [&](const char* what) {
+         if (error)
+            *error = std::string(path) + ": " + what;
+         return GProgram();
+      };
+#if GVM_MMAP
+      int fd = ::open(path, O_RDONLY);
+      if (fd < 0)
+         return fail(strerror(errno));
+      struct stat st;
+      if (fstat(fd, &st) != 0) {
+         int e = errno;
+         ::close(fd);
+         return fail(strerror(e));
+      }
+      program.image = std::make_shared<Image>();
+      if (st.st_size > 0) { // mmap() refuses a length of 0
+         void* p = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+         if (p == MAP_FAILED) {
+            int e = errno;
+            ::close(fd);
+            return fail(strerror(e));
+         }
+         program.image->mapping = p;
+         program.image->mapped = size_t(st.st_size);
+      }
+      ::close(fd); // the mapping stays valid
+      std::string why;
+      if (!program.image->parse(GView<uint8_t>(static_cast<const uint8_t*>(program.image->mapping), program.image->mapped), &why))
+         return fail(why.c_str());
+#else
+      std::ifstream file(path, std::ios::binary | std::ios::ate);
+      if (!file.is_open())
+         return fail("can't open file");
+      std::vector<uint8_t> bytes(size_t(file.tellg()));
+      file.seekg(0);
+      if (!file.read(reinterpret_cast<char*>(bytes.data()), bytes.size()))
+         return fail("can't read file");
+      std::string why;
+      program = load(std::move(bytes), &why);
+      if (!program)
+         return fail(why.c_str());
+#endif
+      return program;
+   }
+
+   explicit operator bool() const { return image != nullptr; }
+
+   GView<uint8_t> bytes() const { return image ? image->bytes : GView<uint8_t>(); }
+   const uint8_t* data() const { return bytes().data(); }
+   size_t size() const { return bytes().size(); }
+
+   // true if the bytes are a read-only mapping of the file
+   bool mapped() const { return image && image->mapping; }
+
+   // the io image (DATA): runs of cells to store before a run, in order
+   const std::vector<GDataRun>& ioImage() const { return image ? image->data : none<GDataRun>(); }
+
+   // the labels of the source, if the container has them
+   const std::vector<GSymbol>& symbols() const { return image ? image->symbols : none<GSymbol>(); }
+
+   // the line map, by pc; empty for raw bytecode
+   GView<GLine> lines() const { return image ? image->lines : GView<GLine>(); }
+
+   // the source line of the instruction at or before 'pc'; 0 if unknown
+   uint32_t sourceLine(uint64_t pc) const {
+      GView<GLine> map = lines();
+      size_t low = 0, high = map.size(); // first entry after pc
+      while (low < high) {
+         size_t mid = (low + high) / 2;
+         if (map[mid].pc <= pc)
+            low = mid + 1;
+         else
+            high = mid;
+      }
+      return low ? map[low - 1].line : 0;
+   }
+
+   // the contents of section 'type' (GSECTION_*, GSECTION_META included); empty if there is none
+   GView<uint8_t> section(uint32_t type) const {
+      if (image)
+         for (const auto& sec : image->sections)
+            if (sec.first == type)
+               return sec.second;
+      return GView<uint8_t>();
+   }
+
+   // the T derived from this program, made by make() (returning a T) the
+   // first time it is asked for; each type T has one slot. If threads ask
+   // at the same time, each may call make(), and all get the result that
+   // was stored first
+   template <class T, class Make>
+   std::shared_ptr<const T> derived(Make make) const {
+      if (!image)
+         return std::make_shared<const T>(make());
+      std::type_index key(typeid(T));
+      {
+         std::lock_guard<std::mutex> lock(image->lock);
+         for (const auto& d : image->derived)
+            if (d.first == key)
+               return std::static_pointer_cast<const T>(d.second);
+      }
+      std::shared_ptr<const T> made = std::make_shared<const T>(make()); // not under the lock: make() may take long
+      std::lock_guard<std::mutex> lock(image->lock);
+      for (const auto& d : image->derived)
+         if (d.first == key)
+            return std::static_pointer_cast<const T>(d.second);
+      image->derived.emplace_back(key, made);
+      return made;
+   }
+
+   // the same program (not just the same bytes)
+   bool operator==(const GProgram& other) const { return image == other.image; }
+   bool operator!=(const GProgram& other) const { return image != other.image; }
+
+private:
+
+   template <class T>
+   static const std::vector<T>& none() {
+      static const std::vector<T> empty;
+      return empty;
+   }
+
+   struct Image {
+      GView<uint8_t>        bytes;             // the code
+      std::vector<uint8_t>  owned;             // the file, unless mapped
+      void*                 mapping = nullptr; // the file, if mapped
+      size_t                mapped = 0;
+      std::vector<std::pair<uint32_t, GView<uint8_t>>> sections;
+      std::vector<GDataRun> data;
+      std::vector<GSymbol>  symbols;
+      GView<GLine>          lines;
+      std::mutex            lock;              // guards derived
+      std::vector<std::pair<std::type_index, std::shared_ptr<const void>>> derived;
+
+      Image() = default;
+      Image(const Image&) = delete;
+      Image& operator=(const Image&) = delete;
+      ~Image() {
+#if GVM_MMAP
+         if (mapping)
+            munmap(mapping, mapped);
+#endif
+      }
+
+      // finds the sections of 'file'; raw bytecode is all code
+      bool parse(GView<uint8_t> file, std::string* error) {
+         auto fail = [&](const char* what) {
+            if (error)
+               *error = what;
+            return false;
+         };
+         GFileHeader header;
+         if (file.size() < sizeof(header) || memcmp(file.data(), GFILE_MAGIC, 4) != 0) {
+            bytes = file;
+            return true;
+         }
+         memcpy(&header, file.data(), sizeof(header));
+         if (header.version > GFILE_VERSION)
+            return fail("container of a later version");
+         if (uint64_t(header.sections) * sizeof(GFileSection) > file.size() - sizeof(header))
+            return fail("truncated section table");
+         for (uint16_t i = 0; i < header.sections; ++i) {
+            GFileSection sec;
+            memcpy(&sec, file.data() + sizeof(header) + i * sizeof(sec), sizeof(sec));
+            if (sec.offset > file.size() || sec.size > file.size() - sec.offset)
+               return fail("section beyond the end of the file");
+            if (sec.offset % 8 != 0)
+               return fail("misaligned section");
+            sections.emplace_back(sec.type, GView<uint8_t>(file.data() + sec.offset, size_t(sec.size)));
+         }
+         for (const auto& sec : sections) {
+            const uint8_t* p = sec.second.data();
+            size_t size = sec.second.size();
+            switch (sec.first) {
+            case GSECTION_CODE:
+               bytes = sec.second;
+               break;
+            case GSECTION_DATA:
+               for (size_t at = 0; at < size; ) {
+                  uint64_t head[2];
+                  if (size - at < sizeof(head))
+                     return fail("truncated data section");
+                  memcpy(head, p + at, sizeof(head));
+                  at += sizeof(head);
+                  if (head[1] > (size - at) / sizeof(uint64_t))
+                     return fail("truncated data section");
+                  data.push_back(GDataRun { head[0], GView<uint64_t>(reinterpret_cast<const uint64_t*>(p + at), size_t(head[1])) });
+                  at += head[1] * sizeof(uint64_t);
+               }
+               break;
+            case GSECTION_SYMBOLS:
+               for (size_t at = 0; at < size; ) {
+                  uint32_t head[2];
+                  if (size - at < sizeof(head))
+                     return fail("truncated symbol section");
+                  memcpy(head, p + at, sizeof(head));
+                  at += sizeof(head);
+                  if (head[1] > size - at)
+                     return fail("truncated symbol section");
+                  symbols.push_back(GSymbol { std::string(reinterpret_cast<const char*>(p + at), head[1]), head[0] });
+                  at += head[1];
+               }
+               break;
+            case GSECTION_LINES:
+               if (size % sizeof(GLine) != 0)
+                  return fail("truncated line section");
+               lines = GView<GLine>(reinterpret_cast<const GLine*>(p), size / sizeof(GLine));
+               break;
+            }
+         }
+         return true;
+      }
+   };
+
+   std::shared_ptr<Image> image;
+};
+
+#endif
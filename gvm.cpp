@@ -5,11 +5,15 @@
 
   MyClass myObject;
   gvm.setCallback(std::bind(&MyClass::myCallbackMethod, &myObject));
+
+  Functions of the host function table (HOST n) are plain function pointers
+  with a context pointer of their own, see example_host_print().
 */
 
-#define DEBUG
 #include "gvm.hpp"
 
+#include <algorithm>
+#include <cstdlib>
 #include <iostream>
 #include <fstream>
 
@@ -20,31 +24,132 @@ void example_host_function() {
    std::cout << "example_host_function() called by the bytecode, pc = " << vm->PC << std::endl;
 }
 
+// HOST 0: prints R and returns it unchanged
+uint64_t example_host_print(GVM&, void* context, uint64_t r) {
+   std::cout << static_cast<const char*>(context) << r << std::endl;
+   return r;
+}
+
+// prints the events recorded by --debug
+void print_trace(const GTrace& trace) {
+   static const char* const names[] = { "", "read", "write", "call", "ret", "host" };
+   if (trace.recorded() > trace.size())
+      std::cout << "(" << trace.recorded() - trace.size() << " older trace events dropped)" << std::endl;
+   for (size_t i = 0; i < trace.size(); ++i) {
+      const GTraceEvent& e = trace[i];
+      if (e.kind == TRACE_INSTR)
+         std::cout << "PC=" << e.pc << " R=" << e.a << " OPC=" << int(e.opcode) << " STK(" << e.b << ")" << std::endl;
+      else
+         std::cout << "   " << names[e.kind] << " " << e.a << " " << e.b << std::endl;
+   }
+}
+
 int main(int argc, char* argv[]) {
    std::memset(&(io[0]), 0, sizeof(uint64_t) * IO_SIZE);
 
    if (argc < 2) {
-      std::cerr << "Usage: " << argv[0] << " <filename> [--debug]" << std::endl;
+      std::cerr << "Usage: " << argv[0] << " <filename> [--debug] [--decoded|--switch|--quick|--jit|--native <file.so>] [--blocks|--blocks-exact] [--verify] [--profile <file.prof>] [--slice <n>] [--memory <pages>]" << std::endl;
       return 1;
    }
 
-   bool debug = (argc > 2);
+   bool debug = false;
+   uint8_t engine = ENGINE_INTERP;
+   const char* native = nullptr;
+   uint8_t limitMode = LIMIT_EXACT;
+   bool verify = false;
+   const char* profile = nullptr;
+   uint64_t slice = 0;
+   uint64_t pages = 0;
+   for (int i = 2; i < argc; ++i) {
+      if (std::string(argv[i]) == "--decoded")
+         engine = ENGINE_DECODED;
+      else if (std::string(argv[i]) == "--switch")
+         engine = ENGINE_SWITCH;
+      else if (std::string(argv[i]) == "--quick")
+         engine = ENGINE_QUICK;
+      else if (std::string(argv[i]) == "--jit")
+         engine = ENGINE_JIT;
+      else if (std::string(argv[i]) == "--blocks")
+         limitMode = LIMIT_BLOCK;
+      else if (std::string(argv[i]) == "--blocks-exact")
+         limitMode = LIMIT_BLOCK_EXACT;
+      else if (std::string(argv[i]) == "--verify")
+         verify = true;
+      else if (std::string(argv[i]) == "--profile" && i + 1 < argc)
+         profile = argv[++i];
+      else if (std::string(argv[i]) == "--slice" && i + 1 < argc)
+         slice = std::strtoull(argv[++i], nullptr, 10);
+      else if (std::string(argv[i]) == "--memory" && i + 1 < argc)
+         pages = std::strtoull(argv[++i], nullptr, 10);
+      else if (std::string(argv[i]) == "--native" && i + 1 < argc) {
+         engine = ENGINE_NATIVE;
+         native = argv[++i];
+      }
+      else
+         debug = true;
+   }
 
    // Load the bytecode
    const char* filename = argv[1];
-   std::ifstream file(filename, std::ios::binary);
-   if (!file.is_open()) {
-      std::cerr << "Error opening file: " << filename << std::endl;
+   std::string error;
+   GProgram program = GProgram::open(filename, &error);
+   if (!program) {
+      std::cerr << "Error opening file: " << error << std::endl;
       return 1;
    }
-   std::vector<uint8_t> code(std::istreambuf_iterator<char>(file), {});
-   file.close();
 
    // Run the bytecode
-   vm = new GVM(io, code, example_host_function);
-   vm->setDebug(debug);
-   vm->run();
+   vm = new GVM(io, program, example_host_function);
+   if (!vm->loadIoImage())
+      std::cerr << "Warning: the io image of " << filename << " doesn't fit in " << IO_SIZE << " cells" << std::endl;
+   vm->setHostFunction(0, example_host_print, (void*)"HOST 0 called by the bytecode, R = ");
+   GTrace trace(1 << 16);
+   if (debug)
+      vm->setTracer(&trace);
+   GProfile profiler;
+   if (profile)
+      vm->setProfiler(&profiler);
+   GMemory memory(pages);
+   if (pages)
+      vm->setMemory(&memory);
+   vm->setEngine(engine);
+   vm->setLimitMode(limitMode);
+   if (verify && !vm->verify(&error)) {
+      std::cerr << "Verification failed: " << error << std::endl;
+      delete vm;
+      return 1;
+   }
+   if (native && !vm->loadNative(native))
+      std::cerr << "Warning: " << native << " was not compiled from " << filename << ", interpreting it instead" << std::endl;
+   if (slice) {
+      // time-sliced: resume() 'slice' instructions at a time, up to the limit of run()
+      uint64_t slices = 1;
+      while (vm->resume(std::min(slice, DEFAULT_OP_LIMIT - vm->count))) {
+         if (vm->count >= DEFAULT_OP_LIMIT) {
+            vm->term = ERR_OPLIMIT;
+            break;
+         }
+         ++slices;
+      }
+      std::cout << "ran in " << slices << " slices of " << slice << " instructions" << std::endl;
+   } else {
+      vm->run();
+   }
+   if (debug)
+      print_trace(trace);
+   if (profile) {
+      std::ofstream out(profile);
+      profiler.report(out);
+      if (!out)
+         std::cerr << "Error writing profile: " << profile << std::endl;
+   }
    std::cout << "vm.run() ended, term = " << vm->term << " opcode = " << int(vm->opcode) << std::endl;
+   if (vm->term != ERR_OK && vm->PC > 0) {
+      // an instruction that fails has consumed its opcode; the op limit stops before one
+      uint32_t line = program.sourceLine(vm->term == ERR_OPLIMIT ? vm->PC : vm->PC - 1);
+      if (line)
+         std::cout << "at line " << line << " of the source" << std::endl;
+   }
 
    // Dump all io (includes registers)
    bool skipped = false;
@@ -67,6 +172,8 @@ int main(int argc, char* argv[]) {
          skipped = true;
       }
    }
+   if (pages)
+      std::cout << memory.pages() << " memory pages resident" << std::endl;
 
    bool success = vm->term != 0;
 
@@ -20,19 +20,105 @@
   The void(void) callback function provided to the GVM upon construction can
   then read and write the state of the GVM at will before returning to the GVM.
 
+  HOST n (OP_HOSTN) calls function n of the host function table instead (see
+  setHostFunction()). The function gets R as its argument and its result is
+  assigned to R; it can pop further arguments from the stack. With the STACK
+  bit, n is popped from the stack. A number without a function is ERR_HOSTCALL.
+
+  resume(n) runs a program in slices of at most n instructions; all state
+  stays in the VM between slices. A host function can end a slice early with
+  yield().
+
+  snapshot() and restore() save and reload io, stack and call stack; copies of
+  a GSnapshot share its io pages copy-on-write. fork() copies the current
+  state to a second VM. The snapshot a VM last took or restored is its base:
+  restoring a snapshot that shares its pages, or forking into a VM with the
+  same base, copies only the io lines written since.
+
+  reset() prepares a VM for another run, clearing only the io lines that
+  were written since the last reset().
+
+  setMemory() attaches a GMemory: io addresses beyond IO_SIZE then reach its
+  sparse, lazily allocated pages instead of failing with ERR_SEGFAULT.
+
+  A VM runs a std::vector it refers to, or a GProgram (gprogram.hpp): bytecode
+  that is mapped from a file and shared, with its decoded form, by any number
+  of VMs. A program's io image (gasm DATA) is copied into io when the VM gets
+  the program, and again by reset().
+
+  With GVMMaskedChecks or GVMGuardedChecks, addresses are masked into io or
+  checked by guard pages (gguard.hpp) instead of compared with IO_SIZE.
+
   Several opcodes can have the STACK bit set to modify their default
   register-based implementation to a stack-based implementation. Since the
   opcode is just 1 byte, this flag limits the opcode range to [0, 127].
 
+  Superinstructions fuse the sequences that gasm emits for expressions and
+  control macros, so that they take one dispatch instead of several:
+    - PUSHED binary ops (PADD a b): PUSH a PUSH b ADD; the result is pushed
+      and R is left alone (not ANDL, whose stack form sets R)
+    - compare-and-branch (JFLT a b L): PUSH a PUSH b LT JF L; with the STACK
+      bit (JFLT L) the operands are popped, as LT JF L
+    - increment-compare-branch (INCJLT a b L): INC a LT @a b JT @1 L; R is
+      set to the comparison like LT does
+
+  The interpreter takes a hook policy (see GVMNoHooks) that is told about
+  each instruction, io access, CALL, RET and HOST. setTracer() makes run()
+  use the GTraceHooks instantiation, which records these events in a GTrace
+  ring buffer; without a tracer the hooks are empty and compile to nothing.
+
+  setProfiler() does the same with GProfileHooks, which count executions and
+  cycles per opcode and per code address, and calls and inclusive cycles per
+  CALL target, into a GProfile. Its report() is what gdis annotates.
+
+  Besides the bytecode interpreter, the GVM can run a program from its decoded
+  form (see decode()): a load-time pass turns the bytecode into an array of
+  fixed-width instruction records (opcode, operand kinds, immediates and
+  resolved jump targets), so that loops don't re-parse operand control bytes
+  on every iteration. Select it with setEngine(ENGINE_DECODED).
+
 */
 
+#ifndef GVM_HPP
+#define GVM_HPP
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <climits>
 #include <cstdint>
 #include <cstring>
+#include <string>
 #include <vector>
 #include <functional>
+#include <memory>
+#include <ostream>
 
-#ifdef DEBUG
-#include <iostream>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+#include "gprogram.hpp"
+
+// GCC and Clang support labels as values, which the interpreter uses to jump
+// straight from each opcode handler to the next one (direct threading) instead
+// of going back through a single switch; other compilers get the switch
+#ifndef GVM_COMPUTED_GOTO
+#if defined(__GNUC__)
+#define GVM_COMPUTED_GOTO 1
+#else
+#define GVM_COMPUTED_GOTO 0
+#endif
+#endif
+
+// the interpreter keeps PC, R and S in a local Regs that is passed by reference
+// to the operand helpers; unless those are inlined the Regs has to live in memory
+#if defined(__GNUC__)
+#define GVM_INLINE inline __attribute__((always_inline))
+#else
+#define GVM_INLINE inline
 #endif
 
 enum {
@@ -44,7 +130,11 @@ enum {
    ERR_UNDERFLOW  = 5,  // stack is empty on pop
    ERR_RET        = 6,  // RET without CALL to return from
    ERR_SEGFAULT   = 7,  // invalid io address accessed
-   ERR_NEGNUM     = 8   // arithmetic underflow
+   ERR_NEGNUM     = 8,  // arithmetic underflow
+   ERR_OVERFLOW   = 9,  // stack is full on push
+   ERR_HOSTCALL   = 10, // HOST n without a host function registered as n
+   ERR_YIELD      = 11, // the host called yield(); resume() continues the program
+   ERR_MEMORY     = 12  // a write needs a page beyond the maximum of the GMemory
 };
 
 enum : uint8_t {
@@ -82,7 +172,23 @@ enum : uint8_t {
    OP_GE          = 31,
    OP_LE          = 32,
    OP_NEG         = 33,
-   OP_ORL         = 34
+   OP_ORL         = 34,
+
+   // superinstructions (see below)
+   OP_JFEQ        = 35,
+   OP_JFNE        = 36,
+   OP_JFGT        = 37,
+   OP_JFLT        = 38,
+   OP_JFGE        = 39,
+   OP_JFLE        = 40,
+   OP_INCJEQ      = 41,
+   OP_INCJNE      = 42,
+   OP_INCJGT      = 43,
+   OP_INCJLT      = 44,
+   OP_INCJGE      = 45,
+   OP_INCJLE      = 46,
+
+   OP_HOSTN       = 47  // HOST n: calls the host function table
 };
 
 const uint8_t REG_PTR = 0x80; // misnomer: this is a pointer to the memory (io)
@@ -90,28 +196,740 @@ const uint8_t SHORT_VAL = 0x40;
 const uint8_t MAX_SHORT_VAL = 0x3F; // 63 (also control byte bitmask)
 
 const uint8_t STACK = 0x80; // opcode reads/writes the stack instead
+const uint8_t PUSHED = 0x40; // binary opcode takes register-form operands and pushes its result
 
+// defaults of the GVM template (see BasicGVM)
 const uint64_t IO_SIZE = 1024; // 8 Kb of IO memory
 const uint64_t REG_SIZE = 8;
+
+// default capacity of the operand stack, in values (see BasicGVM); the stack
+// is stored inline in the GVM, so this is also its memory cost per instance
+// (8 Kb by default)
+#ifndef GVM_STACK_SIZE
+#define GVM_STACK_SIZE 1024
+#endif
+const uint64_t STACK_SIZE = GVM_STACK_SIZE;
+
+// io cells per cache line, the unit in which reset() tracks written io
+const uint64_t IO_LINE = 8;
 const uint64_t DEFAULT_OP_LIMIT = 50000;
 
-class GVM {
+enum : uint8_t {
+   ENGINE_INTERP  = 0,  // bytecode interpreter (threaded dispatch if GVM_COMPUTED_GOTO)
+   ENGINE_DECODED = 1,  // runs from the decoded instruction records
+   ENGINE_SWITCH  = 2,  // bytecode interpreter, portable switch dispatch
+   ENGINE_JIT     = 3,  // x86-64 native code (gjit.hpp); interpreter elsewhere
+   ENGINE_NATIVE  = 4,  // ahead-of-time compiled code (gvm2c, gnative.hpp), see loadNative()
+   ENGINE_QUICK   = 5   // interpreter that quickens each instruction the first time it runs
+};
+
+// how the decoded engine enforces the op limit
+enum : uint8_t {
+   LIMIT_EXACT       = 0,  // checked before every instruction
+   LIMIT_BLOCK       = 1,  // charged once per basic block: ERR_OPLIMIT when the next block doesn't fit
+   LIMIT_BLOCK_EXACT = 2   // as LIMIT_BLOCK, but the block that doesn't fit runs with per-instruction checks
+};
+
+// version of the GVMNativeContext layout, checked when loading gvm2c output
+const uint64_t NATIVE_ABI = 1;
+
+
+// state shared with native code (JIT): plain C layout, offsets are baked into
+// the generated code
+struct GVMNativeContext {
+   uint64_t* io;
+   uint64_t  count;
+   uint64_t  limit;
+   uint64_t  term;
+   uint64_t  opcode;
+   void*     vm;
+   void    (*step)(GVMNativeContext*); // runs the instruction at PC with GVM::step()
+};
+
+// 64-bit FNV-1a hash of a program, identifies the bytecode a gvm2c shared object was built from
+inline uint64_t codeHash(GView<uint8_t> code) {
+   uint64_t h = 14695981039346656037ULL;
+   for (uint8_t b : code) {
+      h ^= b;
+      h *= 1099511628211ULL;
+   }
+   return h;
+}
+
+// operand layout of an opcode byte (STACK bit included), as consumed by GVM::run
+struct OpLayout {
+   bool    valid;    // opcode byte is implemented
+   uint8_t operands; // number of operands with a control byte
+   bool    target;   // followed by a raw uint16_t jump target (no control byte)
+};
+
+constexpr OpLayout opLayout(uint8_t opcode) {
+   switch (opcode) {
+   case OP_NOP:
+   case OP_TERM:
+   case OP_HOST:
+   case OP_HOSTN | STACK:
+      return { true, 0, false };
+   case OP_JMP:
+   case OP_CALL:
+   case OP_JF | STACK:
+   case OP_JT | STACK:
+      return { true, 0, true };
+   case OP_JF:
+   case OP_JT:
+      return { true, 1, true };
+   case OP_JFEQ:
+   case OP_JFNE:
+   case OP_JFGT:
+   case OP_JFLT:
+   case OP_JFGE:
+   case OP_JFLE:
+   case OP_INCJEQ:
+   case OP_INCJNE:
+   case OP_INCJGT:
+   case OP_INCJLT:
+   case OP_INCJGE:
+   case OP_INCJLE:
+      return { true, 2, true };
+   case OP_JFEQ | STACK:
+   case OP_JFNE | STACK:
+   case OP_JFGT | STACK:
+   case OP_JFLT | STACK:
+   case OP_JFGE | STACK:
+   case OP_JFLE | STACK:
+      return { true, 0, true };
+   case OP_NOT:
+   case OP_INC:
+   case OP_DEC:
+   case OP_PUSH:
+   case OP_POP:
+   case OP_RET:
+   case OP_NEG:
+   case OP_HOSTN:
+      return { true, 1, false };
+   case OP_SET:
+   case OP_ADD:
+   case OP_SUB:
+   case OP_MUL:
+   case OP_DIV:
+   case OP_MOD:
+   case OP_OR:
+   case OP_ANDL:
+   case OP_XOR:
+   case OP_SHL:
+   case OP_SHR:
+   case OP_AND:
+   case OP_VPUSH:
+   case OP_VPOP:
+   case OP_EQ:
+   case OP_NE:
+   case OP_GT:
+   case OP_LT:
+   case OP_GE:
+   case OP_LE:
+   case OP_ORL:
+   case OP_ADD | PUSHED:
+   case OP_SUB | PUSHED:
+   case OP_MUL | PUSHED:
+   case OP_DIV | PUSHED:
+   case OP_MOD | PUSHED:
+   case OP_OR | PUSHED:
+   case OP_XOR | PUSHED:
+   case OP_SHL | PUSHED:
+   case OP_SHR | PUSHED:
+   case OP_AND | PUSHED:
+   case OP_EQ | PUSHED:
+   case OP_NE | PUSHED:
+   case OP_GT | PUSHED:
+   case OP_LT | PUSHED:
+   case OP_GE | PUSHED:
+   case OP_LE | PUSHED:
+   case OP_ORL | PUSHED:
+      return { true, 2, false };
+   case OP_ADD | STACK:
+   case OP_SUB | STACK:
+   case OP_MUL | STACK:
+   case OP_DIV | STACK:
+   case OP_MOD | STACK:
+   case OP_OR | STACK:
+   case OP_ANDL | STACK:
+   case OP_XOR | STACK:
+   case OP_NOT | STACK:
+   case OP_SHL | STACK:
+   case OP_SHR | STACK:
+   case OP_AND | STACK:
+   case OP_EQ | STACK:
+   case OP_NE | STACK:
+   case OP_GT | STACK:
+   case OP_LT | STACK:
+   case OP_GE | STACK:
+   case OP_LE | STACK:
+   case OP_NEG | STACK:
+   case OP_ORL | STACK:
+      return { true, 0, false };
+   default:
+      return { false, 0, false };
+   }
+}
+
+static_assert(!opLayout(0x7F).valid, "raw bytecode must not start like a container (GFILE_MAGIC)");
+
+// operand stack values an opcode byte pops and pushes
+struct OpStack {
+   uint8_t pops;
+   uint8_t pushes;
+};
+
+constexpr OpStack opStack(uint8_t opcode) {
+   switch (opcode) {
+   case OP_PUSH:
+      return { 0, 1 };
+   case OP_POP:
+   case OP_JF | STACK:
+   case OP_JT | STACK:
+   case OP_HOSTN | STACK:
+      return { 1, 0 };
+   case OP_NOT | STACK:
+   case OP_NEG | STACK:
+      return { 1, 1 };
+   case OP_ANDL | STACK: // result goes to R
+   case OP_JFEQ | STACK:
+   case OP_JFNE | STACK:
+   case OP_JFGT | STACK:
+   case OP_JFLT | STACK:
+   case OP_JFGE | STACK:
+   case OP_JFLE | STACK:
+      return { 2, 0 };
+   default:
+      if (opLayout(opcode).valid && (opcode & PUSHED) && !(opcode & STACK))
+         return { 0, 1 };
+      if (opcode & STACK)
+         return { 2, 1 };
+      return { 0, 0 };
+   }
+}
+
+// how a GVM keeps io addresses inside io (CheckPolicy::addressing)
+enum : uint8_t {
+   IO_CHECKED   = 0,  // compared with IO_SIZE: ERR_SEGFAULT (or the GMemory) beyond it
+   IO_UNCHECKED = 1,  // not checked: an address beyond io is undefined behavior
+   IO_MASKED    = 2,  // IO_SIZE is rounded up to a power of two and addresses wrap around it
+   IO_GUARDED   = 3   // 32-bit addresses into a GGuardedIo: the fault of one beyond io is ERR_SEGFAULT
+};
+
+// run-time checks of a GVM (see BasicGVM). Without one of them, the program
+// that would have failed the check has undefined behavior instead: leave
+// them out only for programs that are known not to need them.
+struct GVMChecks {
+   static constexpr uint8_t addressing = IO_CHECKED;
+   static constexpr bool    opLimit    = true;  // ERR_OPLIMIT (run() limits are ignored without it)
+   static constexpr bool    negNum     = true;  // ERR_NEGNUM when SUB underflows
+};
+
+// for verified code that is trusted to terminate and stay in bounds
+struct GVMNoChecks {
+   static constexpr uint8_t addressing = IO_UNCHECKED;
+   static constexpr bool    opLimit    = false;
+   static constexpr bool    negNum     = false;
+};
+
+// GVMChecks, but out-of-range addresses wrap around instead of failing
+struct GVMMaskedChecks : GVMChecks {
+   static constexpr uint8_t addressing = IO_MASKED;
+};
+
+// GVMChecks, but out-of-range addresses fault in the guard pages of a
+// GGuardedIo (gguard.hpp) instead of being compared with IO_SIZE
+struct GVMGuardedChecks : GVMChecks {
+   static constexpr uint8_t addressing = IO_GUARDED;
+};
+
+// smallest power of two >= n
+constexpr uint64_t gvmCeilPow2(uint64_t n, uint64_t p = 1) { return p >= n ? p : gvmCeilPow2(n, 2 * p); }
+
+template <uint64_t IoSize, uint64_t RegSize, class CheckPolicy, uint64_t StackSize>
+class BasicGVM;
+
+// trace events, as GTraceHooks records them
+enum : uint8_t {
+   TRACE_INSTR = 0,  // an instruction starts: a = R, b = stack depth
+   TRACE_READ  = 1,  // a pointer operand is read: a = io address, b = value
+   TRACE_WRITE = 2,  // an io cell is written: a = io address, b = value
+   TRACE_CALL  = 3,  // CALL: a = function address, b = call depth before it
+   TRACE_RET   = 4,  // RET: a = return address, b = call depth after it
+   TRACE_HOST  = 5   // HOST (a = 0) or HOST n (a = n): b = R
+};
+
+struct GTraceEvent {
+   uint32_t pc;      // address of the instruction (programs are < 64 Kb)
+   uint8_t  kind;    // TRACE_*
+   uint8_t  opcode;  // opcode byte of the instruction
+   uint64_t a;
+   uint64_t b;
+};
+
+// ring buffer of trace events, allocated up front: recording is a store, and
+// once it is full each event overwrites the oldest one
+class GTrace {
+public:
+
+   // the capacity is rounded up to a power of two
+   explicit GTrace(size_t capacity = 4096) {
+      size_t n = 1;
+      while (n < capacity)
+         n <<= 1;
+      events.resize(n);
+      mask = n - 1;
+   }
+
+   // starts the events of an instruction
+   void instruction(uint64_t pc, uint8_t opcode, uint64_t a, uint64_t b) {
+      current = uint32_t(pc);
+      op = opcode;
+      record(TRACE_INSTR, a, b);
+   }
+
+   // an event of the current instruction
+   void record(uint8_t kind, uint64_t a, uint64_t b) {
+      GTraceEvent& e = events[head++ & mask];
+      e.pc = current;
+      e.kind = kind;
+      e.opcode = op;
+      e.a = a;
+      e.b = b;
+   }
+
+   // events held, and all events recorded (the oldest may be overwritten)
+   size_t size() const { return head < events.size() ? head : events.size(); }
+   uint64_t recorded() const { return head; }
+
+   // the i-th oldest event held
+   const GTraceEvent& operator[](size_t i) const { return events[(head - size() + i) & mask]; }
+
+   void clear() { head = 0; }
+
+private:
+
+   std::vector<GTraceEvent> events;
+   size_t                   mask;
+   uint64_t                 head = 0;
+   uint32_t                 current = 0;
+   uint8_t                  op = 0;
+};
+
+// hook policy of the interpreter: every hook is called with the VM, while
+// PC, R and S are in the interpreter's locals (io[0..2] are stale), except
+// start and stop, which runHooked() calls around the run. A policy with
+// empty hooks costs nothing.
+struct GVMNoHooks {
+   template <class VM> static void start(VM&) {}
+   template <class VM> static void stop(VM&) {}
+   template <class VM> static void instruction(VM&, uint64_t /*pc*/, uint8_t /*opcode*/, uint64_t /*r*/, size_t /*depth*/) {}
+   template <class VM> static void read(VM&, uint64_t /*addr*/, uint64_t /*value*/) {}
+   template <class VM> static void write(VM&, uint64_t /*addr*/, uint64_t /*value*/) {}
+   template <class VM> static void call(VM&, uint64_t /*target*/, size_t /*depth*/) {}
+   template <class VM> static void ret(VM&, uint64_t /*to*/, size_t /*depth*/) {}
+   template <class VM> static void host(VM&, uint64_t /*id*/, uint64_t /*r*/) {}
+};
+
+// records the events into the VM's tracer (see BasicGVM::setTracer())
+struct GTraceHooks {
+   template <class VM> static void start(VM&) {}
+   template <class VM> static void stop(VM&) {}
+   template <class VM> static void instruction(VM& vm, uint64_t pc, uint8_t opcode, uint64_t r, size_t depth) {
+      vm.tracer->instruction(pc, opcode, r, depth);
+   }
+   template <class VM> static void read(VM& vm, uint64_t addr, uint64_t value) {
+      vm.tracer->record(TRACE_READ, addr, value);
+   }
+   template <class VM> static void write(VM& vm, uint64_t addr, uint64_t value) {
+      vm.tracer->record(TRACE_WRITE, addr, value);
+   }
+   template <class VM> static void call(VM& vm, uint64_t target, size_t depth) {
+      vm.tracer->record(TRACE_CALL, target, depth);
+   }
+   template <class VM> static void ret(VM& vm, uint64_t to, size_t depth) {
+      vm.tracer->record(TRACE_RET, to, depth);
+   }
+   template <class VM> static void host(VM& vm, uint64_t id, uint64_t r) {
+      vm.tracer->record(TRACE_HOST, id, r);
+   }
+};
+
+// time stamp for the profiler: the TSC where there is one, else nanoseconds
+inline uint64_t gvmTicks() {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+   return __rdtsc();
+#else
+   return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// execution profile, filled in by GProfileHooks over one or more runs. The
+// cycles between two instruction events are charged to the first of them,
+// so they include the dispatch and the hooks themselves.
+class GProfile {
+public:
+
+   struct Counter {
+      uint64_t count = 0;
+      uint64_t cycles = 0;
+   };
+
+   Counter              ops[256];     // per opcode byte
+   std::vector<Counter> pcs;          // per code address
+   std::vector<Counter> calls;        // per CALL target: calls, inclusive cycles
+   uint64_t             instructions = 0;
+   uint64_t             cycles = 0;
+
+   void clear() {
+      for (Counter& c : ops)
+         c = Counter();
+      pcs.clear();
+      calls.clear();
+      instructions = 0;
+      cycles = 0;
+   }
+
+   void start(size_t codeSize) {
+      if (pcs.size() < codeSize) {
+         pcs.resize(codeSize);
+         calls.resize(codeSize);
+      }
+      frames.clear();
+      running = false;
+      last = gvmTicks();
+   }
+
+   void instruction(uint64_t pc, uint8_t opcode) {
+      uint64_t now = gvmTicks();
+      charge(now);
+      ++instructions;
+      ++ops[opcode].count;
+      if (pc < pcs.size())
+         ++pcs[pc].count;
+      current = pc;
+      op = opcode;
+      running = true;
+   }
+
+   void call(uint64_t target) {
+      if (target < calls.size())
+         ++calls[target].count;
+      frames.push_back({ target, gvmTicks() });
+   }
+
+   void ret() {
+      if (!frames.empty()) {
+         leave(frames.back(), gvmTicks());
+         frames.pop_back();
+      }
+   }
+
+   // ends a run: charges the last instruction and the calls still open
+   void stop() {
+      uint64_t now = gvmTicks();
+      charge(now);
+      running = false;
+      for (const Frame& f : frames)
+         leave(f, now);
+      frames.clear();
+   }
+
+   // text report, one counter per line, for gdis:
+   //   op <opcode> <count> <cycles>
+   //   pc <address> <count> <cycles>
+   //   call <target> <calls> <inclusive cycles>
+   void report(std::ostream& out) const {
+      out << "; GVM profile: " << instructions << " instructions, " << cycles << " cycles\n";
+      for (size_t i = 0; i < 256; ++i)
+         if (ops[i].count)
+            out << "op " << i << " " << ops[i].count << " " << ops[i].cycles << "\n";
+      for (size_t i = 0; i < pcs.size(); ++i)
+         if (pcs[i].count)
+            out << "pc " << i << " " << pcs[i].count << " " << pcs[i].cycles << "\n";
+      for (size_t i = 0; i < calls.size(); ++i)
+         if (calls[i].count)
+            out << "call " << i << " " << calls[i].count << " " << calls[i].cycles << "\n";
+   }
+
+private:
+
+   struct Frame {
+      uint64_t target;
+      uint64_t start;
+   };
+
+   void charge(uint64_t now) {
+      if (running) {
+         uint64_t t = now - last;
+         cycles += t;
+         ops[op].cycles += t;
+         if (current < pcs.size())
+            pcs[current].cycles += t;
+      }
+      last = now;
+   }
+
+   void leave(const Frame& f, uint64_t now) {
+      if (f.target < calls.size())
+         calls[f.target].cycles += now - f.start;
+   }
+
+   std::vector<Frame> frames;
+   uint64_t           last = 0;
+   uint64_t           current = 0;
+   uint8_t            op = 0;
+   bool               running = false;
+};
+
+// counts into the VM's profiler (see BasicGVM::setProfiler())
+struct GProfileHooks {
+   template <class VM> static void start(VM& vm) { vm.profiler->start(vm.code.size()); }
+   template <class VM> static void stop(VM& vm) { vm.profiler->stop(); }
+   template <class VM> static void instruction(VM& vm, uint64_t pc, uint8_t opcode, uint64_t, size_t) {
+      vm.profiler->instruction(pc, opcode);
+   }
+   template <class VM> static void read(VM&, uint64_t, uint64_t) {}
+   template <class VM> static void write(VM&, uint64_t, uint64_t) {}
+   template <class VM> static void call(VM& vm, uint64_t target, size_t) { vm.profiler->call(target); }
+   template <class VM> static void ret(VM& vm, uint64_t, size_t) { vm.profiler->ret(); }
+   template <class VM> static void host(VM&, uint64_t, uint64_t) {}
+};
+
+#include "gjit.hpp"
+#include "gnative.hpp"
+#include "gguard.hpp"
+
+// the operand stack: a fixed-capacity array of Capacity values instead of a
+// std::vector, so a push is a bounds check and a store, and no program can
+// make the VM allocate. Value i is in slot[i + 1]; slot[0] is scratch, so
+// that the interpreter can spill its cached top of stack (see GVM::Regs)
+// without checking for empty.
+template <uint64_t Capacity = STACK_SIZE>
+class GStack {
+public:
+
+   size_t size() const { return n; }
+   bool empty() const { return n == 0; }
+   void clear() { n = 0; }
+
+   // false if the stack is full
+   bool push_back(uint64_t value) {
+      if (n == Capacity)
+         return false;
+      slot[++n] = value;
+      return true;
+   }
+
+   void pop_back() { if (n) --n; }
+   uint64_t back() const { return slot[n]; }
+
+   uint64_t operator[](size_t i) const { return slot[i + 1]; }
+   const uint64_t* begin() const { return slot + 1; }
+   const uint64_t* end() const { return slot + 1 + n; }
+
+private:
+
+   template <uint64_t IoSize, uint64_t RegSize, class CheckPolicy, uint64_t StackSize>
+   friend class BasicGVM;
+
+   uint64_t slot[Capacity + 1];
+   size_t   n = 0;
+};
+
+// A saved VM state (see BasicGVM::snapshot()): io, stack, call stack, term
+// and count. io is kept in pages that copies of a snapshot share until one of
+// them writes a page with set(), so forking a prepared state and changing a
+// few inputs copies only the pages those inputs are in.
+template <uint64_t IoSize, uint64_t RegSize>
+class GSnapshot {
+public:
+
+   static constexpr uint64_t PAGE_SIZE = 64; // cells
+   static constexpr uint64_t PAGES = (IoSize + PAGE_SIZE - 1) / PAGE_SIZE;
+   typedef std::array<uint64_t, PAGE_SIZE> Page;
+
+   std::vector<std::shared_ptr<Page>>                  pages;   // PAGES pages; the last one is padded with 0
+   std::vector<uint64_t>                               stack;
+   std::vector<std::array<uint64_t, RegSize>>          context;
+   uint64_t                                            term = 0;
+   uint64_t                                            count = 0;
+
+   uint64_t get(uint64_t index) const { return (*pages[index / PAGE_SIZE])[index % PAGE_SIZE]; }
+
+   // writes io cell 'index', copying its page first if another snapshot shares it
+   void set(uint64_t index, uint64_t value) {
+      std::shared_ptr<Page>& page = pages[index / PAGE_SIZE];
+      if (page.use_count() > 1)
+         page = std::make_shared<Page>(*page);
+      (*page)[index % PAGE_SIZE] = value;
+   }
+
+   // true if page i is the same memory in both snapshots
+   bool shares(const GSnapshot& other, uint64_t i) const { return pages[i] == other.pages[i]; }
+};
+
+// Sparse memory behind the io addresses from IO_SIZE up (see
+// BasicGVM::setMemory()): a 64-bit address space of pages that are only
+// allocated when they are first written, at most 'maxPages' of them. Reading
+// a page that was never written gives 0. Pages are found through an open
+// addressing table of the resident pages, with the last page used cached in
+// front of it.
+class GMemory {
+public:
+
+   static constexpr uint64_t PAGE_SIZE = 512; // cells (4 Kb)
+
+   explicit GMemory(size_t maxPages = 256) : maxPages(maxPages) {}
+
+   GMemory(const GMemory&) = delete;
+   GMemory& operator=(const GMemory&) = delete;
+
+   // limits the pages that can be resident; pages already resident stay
+   void setMaxPages(size_t newMaxPages) { maxPages = newMaxPages; }
+
+   size_t pages() const { return resident; }
+
+   uint64_t read(uint64_t addr) {
+      uint64_t* page = find(addr / PAGE_SIZE);
+      return page ? page[addr % PAGE_SIZE] : 0;
+   }
+
+   // the cell at 'addr', allocating its page; nullptr if that would go over maxPages
+   uint64_t* cell(uint64_t addr) {
+      uint64_t number = addr / PAGE_SIZE;
+      uint64_t* page = find(number);
+      if (!page) {
+         if (resident >= maxPages)
+            return nullptr;
+         page = allocate(number);
+      }
+      return page + addr % PAGE_SIZE;
+   }
+
+   // drops all pages; their memory is kept for the pages allocated next
+   void clear() {
+      for (Entry& e : table) {
+         if (e.number != EMPTY) {
+            std::memset(e.cells, 0, sizeof(uint64_t) * PAGE_SIZE);
+            spare.push_back(e.cells);
+            e.number = EMPTY;
+         }
+      }
+      resident = 0;
+      last = EMPTY;
+   }
+
+private:
+
+   static constexpr uint64_t EMPTY = UINT64_MAX; // no page has this number
+
+   struct Entry {
+      uint64_t  number;
+      uint64_t* cells;
+   };
+
+   std::vector<Entry>                       table;        // power of two size, at most half full
+   std::vector<std::unique_ptr<uint64_t[]>> storage;      // every page ever allocated
+   std::vector<uint64_t*>                   spare;        // zeroed pages that clear() released
+   size_t                                   resident = 0;
+   size_t                                   maxPages;
+   uint64_t                                 last = EMPTY; // cache of the last page found
+   uint64_t*                                lastCells = nullptr;
+
+   static size_t slot(uint64_t number, size_t mask) { return (number * 0x9E3779B97F4A7C15ULL) >> 32 & mask; }
+
+   uint64_t* find(uint64_t number) {
+      if (number == last)
+         return lastCells;
+      if (table.empty())
+         return nullptr;
+      size_t mask = table.size() - 1;
+      for (size_t i = slot(number, mask); table[i].number != EMPTY; i = (i + 1) & mask) {
+         if (table[i].number == number) {
+            last = number;
+            lastCells = table[i].cells;
+            return lastCells;
+         }
+      }
+      return nullptr;
+   }
+
+   uint64_t* allocate(uint64_t number) {
+      if (2 * (resident + 1) > table.size())
+         grow();
+      uint64_t* cells;
+      if (spare.empty()) {
+         storage.emplace_back(new uint64_t[PAGE_SIZE]());
+         cells = storage.back().get();
+      } else {
+         cells = spare.back();
+         spare.pop_back();
+      }
+      insert(number, cells);
+      ++resident;
+      last = number;
+      lastCells = cells;
+      return cells;
+   }
+
+   void insert(uint64_t number, uint64_t* cells) {
+      size_t mask = table.size() - 1;
+      size_t i = slot(number, mask);
+      while (table[i].number != EMPTY)
+         i = (i + 1) & mask;
+      table[i] = Entry { number, cells };
+   }
+
+   void grow() {
+      std::vector<Entry> old(table.empty() ? 16 : 2 * table.size(), Entry { EMPTY, nullptr });
+      old.swap(table);
+      for (const Entry& e : old)
+         if (e.number != EMPTY)
+            insert(e.number, e.cells);
+   }
+};
+
+// The VM, for io memory of IoSize cells of which the first RegSize are
+// registers, with the run-time checks of CheckPolicy (GVMChecks, GVMNoChecks
+// or a policy of the same form) and an operand stack of StackSize values.
+// GVM is the default configuration; a small IoSize and StackSize keep many
+// instances cheap (the stack is most of the size of a VM), a large IoSize
+// suits data-heavy programs.
+template <uint64_t IoSize = IO_SIZE, uint64_t RegSize = REG_SIZE, class CheckPolicy = GVMChecks, uint64_t StackSize = STACK_SIZE>
+class BasicGVM {
 public:
 
+   static_assert(RegSize >= 3, "PC, R and S are registers");
+   static_assert(StackSize > 0 && StackSize < INT32_MAX, "verify() counts stack depths in int32_t");
+   static_assert(IoSize > RegSize, "io must be larger than the registers");
+   static_assert(CheckPolicy::addressing != IO_GUARDED || GVM_GUARD, "IO_GUARDED needs gguard.hpp support (64-bit Linux or macOS)");
+
+   // the configuration; inside the class these shadow the global defaults
+   static constexpr uint64_t IO_SIZE = CheckPolicy::addressing == IO_MASKED ? gvmCeilPow2(IoSize) : IoSize;
+   static constexpr uint64_t REG_SIZE = RegSize;
+   static constexpr uint64_t STACK_SIZE = StackSize;
+   typedef CheckPolicy Checks;
+
    // type for storing registers in the call stack
    typedef std::array<uint64_t, REG_SIZE> registers_t;
 
    // type of io array
    typedef uint64_t memory_t[IO_SIZE];
 
+   typedef GSnapshot<IO_SIZE, REG_SIZE> Snapshot;
+
    // call stack (just a stack of saved register sets;
    // CALL pushes register range of io into this and
    // RET pops this back into the register range of io)
    std::vector<registers_t>        context;
 
    // global state (not affected by CALL/RET)
-   std::vector<uint64_t>           stack;
-   std::vector<uint8_t>&           code;
+   GStack<STACK_SIZE>              stack;
+   GView<uint8_t>                  code;
+   GProgram                        program; // holds 'code', unless the VM was given a vector
    memory_t&                       io;
 
    // named registers PC(0), R(1), S(2): these are used by the vm
@@ -123,81 +941,1599 @@ public:
    using HostCallback = std::function<void()>;
    HostCallback                    hostCallback;
 
-   uint64_t                        term;   // stores the VM exit code, ==0 OK, >0 error
-   uint64_t                        count;  // counts machine instructions executed
-   uint8_t                         opcode; // last opcode executed
+   // a function of the host function table: called by HOST n with the
+   // context it was registered with and the value of R, returns the new R
+   typedef uint64_t (*HostFunction)(BasicGVM& vm, void* context, uint64_t r);
+   struct HostEntry {
+      HostFunction function;
+      void*        context;
+   };
+   std::vector<HostEntry>          hostTable; // indexed by n; null functions are unregistered
+
+   uint64_t                        term = ERR_OK; // stores the VM exit code, ==0 OK, >0 error
+   uint64_t                        count = 0;     // counts machine instructions executed
+   uint8_t                         opcode; // last opcode executed
+   uint8_t                         engine = ENGINE_INTERP;
+   uint8_t                         limitMode = LIMIT_EXACT;
+
+#if GVM_JIT
+   GJit                            jit;
+#endif
+#if GVM_NATIVE
+   GNative                         native;
+#endif
+
+   GTrace*                         tracer = nullptr;
+   GProfile*                       profiler = nullptr;
+   GMemory*                        memory = nullptr;
+
+   // io lines written since the last reset(), snapshot() or restore(), one
+   // flag per IO_LINE cells (padded to whole words for the scan in reset());
+   // bool rather than a char type, which the compiler would have to assume
+   // aliases everything
+   static constexpr size_t DIRTY_SIZE = ((IO_SIZE + IO_LINE - 1) / IO_LINE + 7) / 8 * 8;
+   bool                            dirty[DIRTY_SIZE] = {};
+   bool                            dirtyAll = true; // all of io may be written: before the first reset(), after HOST...
+   bool                            zeroed = false;  // io is 0 outside the dirty lines: after reset()
+
+   // the io pages of the last snapshot() or restore(), which io is equal to
+   // outside the dirty lines (and the registers, which runs store without
+   // marking them); empty after reset()
+   std::vector<std::shared_ptr<typename Snapshot::Page>> basePages;
+   static constexpr uint64_t PAGE_LINES = Snapshot::PAGE_SIZE / IO_LINE;
+   static_assert(PAGE_LINES == 8 && Snapshot::PAGE_SIZE == 8 * IO_LINE && DIRTY_SIZE >= Snapshot::PAGES * 8,
+                 "a snapshot page is 8 io lines, one word of dirty flags");
+
+   // runs 'program', sharing its bytecode and derived data with the other
+   // VMs that run it; stores its io image in io
+   BasicGVM(uint64_t (&io)[IO_SIZE], const GProgram& program, const HostCallback& hostCallback = nullptr)
+      : code(program.bytes()), program(program), io(io), hostCallback(hostCallback)
+      {
+         loadIoImage();
+      }
+
+   // runs a copy of 'code', like setCode()
+   BasicGVM(uint64_t (&io)[IO_SIZE], const std::vector<uint8_t>& code, const HostCallback& hostCallback = nullptr)
+      : BasicGVM(io, GProgram(code), hostCallback)
+      {}
+
+   // with a tracer, run() records trace events into it, running every engine
+   // as the interpreter; nullptr turns tracing off
+   void setTracer(GTrace* newTracer) { tracer = newTracer; }
+
+   // with a profiler (and no tracer), run() profiles into it, running every
+   // engine as the interpreter; nullptr turns profiling off
+   void setProfiler(GProfile* newProfiler) { profiler = newProfiler; }
+
+   // with a memory, io addresses from IO_SIZE up are its cells instead of
+   // ERR_SEGFAULT (with IO_CHECKED addressing); nullptr detaches it. Constant
+   // addresses beyond io still fail verify(), so such programs run checked
+   void setMemory(GMemory* newMemory) { memory = newMemory; }
+
+   // runs a copy of 'newCode' from now on
+   void setCode(const std::vector<uint8_t>& newCode) { setProgram(GProgram(newCode)); }
+
+   // runs 'newProgram' from now on, and stores its io image in io
+   void setProgram(const GProgram& newProgram) {
+      program = newProgram;
+      code = program.bytes();
+      loadIoImage();
+      useDecoded(nullptr);
+      quick.clear();
+      verified = false;
+      verification.reset();
+      verifyDepth = GView<int32_t>();
+#if GVM_NATIVE
+      native.close();
+#endif
+   }
+
+   void setHostCallback(const HostCallback& newHostCallback) { hostCallback = newHostCallback; }
+
+   // registers 'function' as host function 'id' (nullptr unregisters it); the
+   // table grows to the largest id, so numbers should be kept small and dense
+   void setHostFunction(uint64_t id, HostFunction function, void* context = nullptr) {
+      if (id >= hostTable.size()) {
+         if (!function)
+            return;
+         hostTable.resize(id + 1, HostEntry { nullptr, nullptr });
+      }
+      hostTable[id] = HostEntry { function, context };
+   }
+
+   // HOST with PC, R and S in io[]; the callback may write anywhere in io
+   void callHost() {
+      dirtyAll = true;
+      hostCallback();
+   }
+
+   // HOST n with PC, R and S in io[]; false if n has no function
+   bool hostCall(uint64_t id) {
+      if (id >= hostTable.size() || !hostTable[id].function)
+         return false;
+      dirtyAll = true;
+      const HostEntry& e = hostTable[id];
+      R = e.function(*this, e.context, R);
+      return true;
+   }
+
+   void setEngine(uint8_t newEngine) { engine = newEngine; }
+
+   // LIMIT_BLOCK* only change ENGINE_DECODED; 'count' stays exact in every mode
+   void setLimitMode(uint8_t newLimitMode) { limitMode = newLimitMode; }
+
+   // stores the io image of the program (gasm DATA) in io; false if some of
+   // it is beyond IO_SIZE, which is left out
+   bool loadIoImage() {
+      bool fits = true;
+      for (const GDataRun& run : program.ioImage()) {
+         uint64_t n = run.values.size();
+         if (run.address >= IO_SIZE || n > IO_SIZE - run.address) {
+            fits = false;
+            n = run.address >= IO_SIZE ? 0 : IO_SIZE - run.address;
+         }
+         std::memcpy(&(io[run.address]), run.values.data(), sizeof(uint64_t) * n);
+         touch(run.address, n);
+      }
+      return fits;
+   }
+
+   // loads gvm2c output for the current code; ENGINE_NATIVE interprets the
+   // bytecode if this fails (no such file, or built from a different program)
+   bool loadNative(const char* path) {
+#if GVM_NATIVE
+      return native.open(path, IO_SIZE, code.size(), codeHash(code));
+#else
+      return false;
+#endif
+   }
+
+   void run(uint64_t limit = DEFAULT_OP_LIMIT) {
+      term = ERR_OK;
+      count = 0;
+      execute(limit);
+   }
+
+   // time slicing: runs at most 'budget' more instructions of the program,
+   // from PC, with the stack and call stack as the last slice left them.
+   // Returns true if the program can be resumed: it ran out of budget, or the
+   // host called yield() (from HOST). Unlike run(), running out of budget is
+   // not an error, and 'count' adds up over the slices; a slice costs the
+   // same dispatch as run(). Returns false once 'term' is set or the program
+   // has ended. Without Checks::opLimit the budget is ignored.
+   bool resume(uint64_t budget) {
+      if (term != ERR_OK)
+         return false;
+      uint64_t start = count;
+      execute(budget < UINT64_MAX - count ? count + budget : UINT64_MAX);
+      if (term == ERR_OPLIMIT && count - 1 == start && budget > 0) {
+         // LIMIT_BLOCK and the next block is longer than the budget: one
+         // instruction, with per-instruction limits, keeps the program moving
+         // (through execute(), for the guard and the hooks)
+         --count;
+         term = ERR_OK;
+         uint8_t mode = limitMode;
+         limitMode = LIMIT_EXACT;
+         execute(count + 1);
+         limitMode = mode;
+      }
+      if (term == ERR_OPLIMIT) {
+         --count; // the instruction that didn't fit was counted
+         term = ERR_OK;
+      } else if (term == ERR_YIELD) {
+         term = ERR_OK;
+      }
+      return term == ERR_OK && PC < code.size();
+   }
+
+   // called by the host during HOST: the program stops after the HOST, with
+   // ERR_YIELD, and resume() continues it
+   void yield() { term = ERR_YIELD; }
+
+   // saves io, stack, call stack, term and count, and makes the snapshot the
+   // base of the VM (see restore() and fork()). Pages that the VM hasn't
+   // written since its last base are shared with it; other pages that are
+   // equal to those of 'base' share its memory; the rest are copied
+   Snapshot snapshot(const Snapshot* base = nullptr) {
+      bool based = hasBase();
+      Snapshot snap;
+      snap.pages.resize(Snapshot::PAGES);
+      for (uint64_t i = 0; i < Snapshot::PAGES; ++i) {
+         uint64_t first = i * Snapshot::PAGE_SIZE;
+         size_t bytes = sizeof(uint64_t) * std::min(Snapshot::PAGE_SIZE, IO_SIZE - first);
+         if (based && !pageWritten(i)) {
+            snap.pages[i] = basePages[i];
+         } else if (base && std::memcmp(base->pages[i]->data(), &(io[first]), bytes) == 0) {
+            snap.pages[i] = base->pages[i];
+         } else {
+            snap.pages[i] = std::make_shared<typename Snapshot::Page>();
+            std::memcpy(snap.pages[i]->data(), &(io[first]), bytes);
+         }
+      }
+      snap.stack.assign(stack.begin(), stack.end());
+      snap.context = context;
+      snap.term = term;
+      snap.count = count;
+      rebase(snap);
+      return snap;
+   }
+
+   // puts io, stack, call stack, term and count back as they were in 'snap',
+   // which becomes the base of the VM. Where 'snap' has the same page as the
+   // last base, only the io lines written since are copied, so restoring one
+   // snapshot over and over costs the lines each run touches
+   void restore(const Snapshot& snap) {
+      bool based = hasBase();
+      for (uint64_t i = 0; i < Snapshot::PAGES; ++i) {
+         const uint64_t* page = snap.pages[i]->data();
+         if (based && basePages[i] == snap.pages[i])
+            copyWrittenLines(page, i);
+         else
+            copyPage(page, i);
+      }
+      restoreStack(snap.stack.data(), snap.stack.size());
+      context = snap.context;
+      term = snap.term;
+      count = snap.count;
+      rebase(snap);
+   }
+
+   // makes 'child', a VM of this configuration on its own io, a copy of this
+   // one in its current state, with its code, engine, limit mode and host
+   // functions; the two then run independently. If both VMs have the same
+   // base (the last snapshot() or restore() of each), only the io lines that
+   // either wrote since are copied, so forking a pool of children from one
+   // prepared state over and over costs the lines the runs touch. Otherwise,
+   // or after a HOST or native code (which can write anywhere), all of io is
+   // copied
+   void fork(BasicGVM& child) const {
+      if (child.program != program)
+         child.setProgram(program);
+      child.hostCallback = hostCallback;
+      child.hostTable = hostTable;
+      child.engine = engine;
+      child.limitMode = limitMode;
+      if (hasBase() && child.hasBase() && child.basePages == basePages) {
+         for (uint64_t i = 0; i < Snapshot::PAGES; ++i)
+            if (pageWritten(i) || child.pageWritten(i))
+               for (uint64_t line = i * PAGE_LINES; line < (i + 1) * PAGE_LINES; ++line)
+                  if (dirty[line] || child.dirty[line] || line * IO_LINE < REG_SIZE)
+                     copyLine(&(child.io[line * IO_LINE]), &(io[line * IO_LINE]), line * IO_LINE);
+      } else {
+         std::memcpy(&(child.io[0]), &(io[0]), sizeof(memory_t));
+         child.basePages = basePages;
+      }
+      std::memcpy(child.dirty, dirty, sizeof(dirty));
+      child.dirtyAll = dirtyAll;
+      child.zeroed = false;
+      child.restoreStack(stack.begin(), stack.size());
+      child.context = context;
+      child.term = term;
+      child.count = count;
+      child.opcode = opcode;
+   }
+
+   // a new VM on 'childIo', forked from this one (see fork(BasicGVM&)); it
+   // has no base yet, so all of io is copied
+   std::unique_ptr<BasicGVM> fork(memory_t& childIo) const {
+      std::unique_ptr<BasicGVM> child(new BasicGVM(childIo, program, hostCallback));
+      fork(*child);
+      return child;
+   }
+
+   // gets the VM ready for another run from PC 0: clears io (and the
+   // GMemory), stack, call stack, term and count, keeping the memory of the
+   // stacks, and stores the io image of the program again. Only the io
+   // lines written since the last reset() are cleared, so io written from
+   // outside a run (other than by HOST) must be reported with touch()
+   void reset() {
+      if (dirtyAll || !zeroed) {
+         std::memset(&(io[0]), 0, sizeof(memory_t));
+         std::memset(dirty, 0, sizeof(dirty));
+         dirtyAll = false;
+         zeroed = true;
+      } else {
+         std::memset(&(io[0]), 0, sizeof(uint64_t) * REG_SIZE);
+         for (size_t word = 0; word < DIRTY_SIZE; word += 8) {
+            uint64_t lines;
+            std::memcpy(&lines, dirty + word, 8);
+            if (!lines)
+               continue;
+            for (size_t i = word; i < word + 8; ++i) {
+               if (dirty[i]) {
+                  uint64_t first = i * IO_LINE;
+                  std::memset(&(io[first]), 0, sizeof(uint64_t) * std::min(IO_LINE, IO_SIZE - first));
+                  dirty[i] = false;
+               }
+            }
+         }
+      }
+      if (memory)
+         memory->clear();
+      basePages.clear();
+      loadIoImage();
+      stack.clear();
+      context.clear();
+      term = ERR_OK;
+      count = 0;
+   }
+
+   // records that io cells [first, first + n) were written from outside the VM
+   void touch(uint64_t first, uint64_t n = 1) {
+      for (uint64_t i = first; i < first + n && i < IO_SIZE; i += IO_LINE - i % IO_LINE)
+         dirty[i / IO_LINE] = true;
+   }
+
+   // run() in the bytecode interpreter with the hook policy Hooks
+   template <class Hooks>
+   void runHooked(uint64_t limit = DEFAULT_OP_LIMIT) {
+      term = ERR_OK;
+      count = 0;
+      executeHooked<Hooks>(limit);
+   }
+
+   // runs from PC with the current 'term' and 'count', until 'count' would
+   // go over 'limit'
+   void execute(uint64_t limit) {
+#if GVM_GUARD
+      if (Checks::addressing == IO_GUARDED) {
+         // a fault beyond io comes back here; the run is dead, and PC, R and
+         // S in io are as they were when it last stored them
+         sigjmp_buf fault;
+         GGuard::Scope scope(&fault, &(io[IO_SIZE]));
+         if (sigsetjmp(fault, 0)) {
+            term = ERR_SEGFAULT;
+            return;
+         }
+         dispatch(limit);
+         return;
+      }
+#endif
+      dispatch(limit);
+   }
+
+   void dispatch(uint64_t limit) {
+      if (tracer) {
+         executeHooked<GTraceHooks>(limit);
+         return;
+      }
+      if (profiler) {
+         executeHooked<GProfileHooks>(limit);
+         return;
+      }
+      if (!Checks::opLimit)
+         limit = UINT64_MAX;
+      switch (engine) {
+      case ENGINE_DECODED:
+         if (limitMode == LIMIT_EXACT)
+            runDecoded<false>(limit);
+         else
+            runDecoded<true>(limit);
+         break;
+      case ENGINE_SWITCH:
+         runInterpreter<false>(limit);
+         break;
+      case ENGINE_QUICK:
+         runQuick(limit);
+         break;
+#if GVM_JIT
+      case ENGINE_JIT:
+         jit.run(*this, limit);
+         jit.markWrites(dirty, dirtyAll);
+         break;
+#endif
+#if GVM_NATIVE
+      case ENGINE_NATIVE:
+         if (native.loaded(code.size())) {
+            native.run(*this, limit);
+            dirtyAll = true; // no record of what the compiled code wrote
+         } else {
+            runInterpreter<GVM_COMPUTED_GOTO>(limit);
+         }
+         break;
+#endif
+      default:
+         runInterpreter<GVM_COMPUTED_GOTO>(limit);
+      }
+   }
+
+   template <class Hooks>
+   void executeHooked(uint64_t limit) {
+      if (!Checks::opLimit)
+         limit = UINT64_MAX;
+      Hooks::start(*this);
+      interpret<false, GVM_COMPUTED_GOTO, false, Hooks>(limit);
+      Hooks::stop(*this);
+   }
+
+   // counts an instruction; true if that goes over 'limit'
+   GVM_INLINE bool overLimit(uint64_t limit) {
+      bool over = ++count > limit;
+      return Checks::opLimit && over;
+   }
+
+   // executes the single instruction at PC (if any), without counting it
+   void step() { interpret<true, false>(0); }
+
+   // GVMNativeContext::step for native code
+   static void nativeStep(GVMNativeContext* ctx) {
+      BasicGVM* vm = static_cast<BasicGVM*>(ctx->vm);
+      vm->step();
+      ctx->term = vm->term;
+      ctx->opcode = vm->opcode;
+   }
+
+   // decoded form of one instruction
+   struct Instr {
+      uint8_t  opcode;  // opcode byte (STACK bit included), or OP_SLOW
+      uint8_t  kind;    // IN_PTR1 / IN_PTR2: operand is an io address; IN_STEP
+      uint16_t addr;    // jump address, if the opcode has a target
+      uint32_t pc;      // address of the instruction
+      uint32_t next;    // address of the following instruction
+      uint32_t target;  // decoded index of the jump target, or DECODED_NONE
+      uint64_t op1;     // first operand, or jump address (JMP, CALL)
+      uint64_t op2;     // second operand, or jump address (JT, JF)
+   };
+
+   static constexpr uint8_t  OP_SLOW      = 0x7F;       // not an opcode: run it through step()
+   static constexpr uint8_t  IN_PTR1      = 0x01;
+   static constexpr uint8_t  IN_PTR2      = 0x02;
+   static constexpr uint8_t  IN_STEP      = 0x04;       // may write PC mid-instruction: run it through step()
+   static constexpr uint32_t DECODED_NONE = UINT32_MAX; // not at an instruction boundary
+
+   // the decoded form of a program, shared through its GProgram
+   struct Decoded {
+      std::vector<Instr>    instrs;
+      std::vector<uint32_t> index;
+      std::vector<uint32_t> cost;
+   };
+
+   std::shared_ptr<const Decoded>  decodedForm; // owns the three views below
+
+   // decoded instructions, in code order, and the decoded index of each code address
+   GView<Instr>                    decoded;
+   GView<uint32_t>                 decodedIndex;
+   uint64_t                        decodeEpoch = 0; // bumped by every decode()
+
+   // op limit cost of entering the code at each decoded instruction: the
+   // number of instructions up to and including the next one that can jump
+   // (any opcode with a target, RET, TERM or invalid code), for LIMIT_BLOCK*
+   GView<uint32_t>                 decodedCost;
+
+   void useDecoded(const std::shared_ptr<const Decoded>& form) {
+      decodedForm = form;
+      decoded = form ? GView<Instr>(form->instrs) : GView<Instr>();
+      decodedIndex = form ? GView<uint32_t>(form->index) : GView<uint32_t>();
+      decodedCost = form ? GView<uint32_t>(form->cost) : GView<uint32_t>();
+   }
+
+   // decodes 'code' into 'decoded', or takes the decoded form another VM
+   // made of the same GProgram; must be called again if the code changes
+   void decode() {
+      ++decodeEpoch;
+      useDecoded(program.template derived<Decoded>([this] { return decodeCode(); }));
+   }
+
+   Decoded decodeCode() {
+      Decoded d;
+      std::vector<Instr>& decoded = d.instrs;
+      std::vector<uint32_t>& decodedIndex = d.index;
+      decodedIndex.assign(code.size(), DECODED_NONE);
+      uint64_t pc = 0;
+      while (pc < code.size()) {
+         Instr in = {};
+         in.opcode = code[pc];
+         in.pc = pc;
+         in.target = DECODED_NONE;
+         decodedIndex[pc] = decoded.size();
+         uint64_t npc = pc + 1;
+         OpLayout layout = opLayout(in.opcode);
+         bool ok = layout.valid;
+         bool ptr = false;
+         if (ok && layout.operands >= 1) {
+            ok = decodeOperand(npc, in.op1, ptr);
+            if (ptr)
+               in.kind |= IN_PTR1;
+         }
+         if (ok && layout.operands >= 2) {
+            ok = decodeOperand(npc, in.op2, ptr);
+            if (ptr)
+               in.kind |= IN_PTR2;
+         }
+         if (ok && layout.target) {
+            ok = npc + 2 <= code.size();
+            if (ok) {
+               uint16_t addr;
+               memcpy(&addr, &code[npc], 2); // Little-endian
+               npc += 2;
+               in.addr = addr;
+               if (layout.operands == 0)
+                  in.op1 = addr;
+               else if (layout.operands == 1)
+                  in.op2 = addr;
+            }
+         }
+         // an INCJ* that increments PC reads its bound and branches after
+         // the increment, which only the interpreter gets right
+         if (ok && in.opcode >= OP_INCJEQ && in.opcode <= OP_INCJLE && (in.kind & IN_PTR1 || in.op1 == 0))
+            in.kind |= IN_STEP;
+         if (!ok) {
+            // invalid or truncated: the interpreter knows what to do
+            in.opcode = OP_SLOW;
+            in.kind = 0;
+            if (!layout.valid)
+               npc = pc + 1;
+            else
+               npc = code.size();
+         }
+         in.next = npc;
+         decoded.push_back(in);
+         pc = npc;
+      }
+      // resolve jump targets once all boundaries are known
+      for (Instr& in : decoded) {
+         if (in.opcode != OP_SLOW && opLayout(in.opcode).target)
+            in.target = in.addr < decodedIndex.size() ? decodedIndex[in.addr] : DECODED_NONE;
+      }
+      std::vector<uint32_t>& decodedCost = d.cost;
+      decodedCost.assign(decoded.size(), 1);
+      for (size_t i = decoded.size(); i-- > 0; ) {
+         uint8_t op = decoded[i].opcode;
+         bool jumps = op == OP_SLOW || opLayout(op).target || op == OP_RET || op == OP_TERM;
+         if (!jumps && i + 1 < decoded.size())
+            decodedCost[i] = decodedCost[i + 1] + 1;
+      }
+      return d;
+   }
+
+   // decoded index of the instruction at 'pc'
+   uint32_t locate(uint64_t pc) {
+      return pc < decodedIndex.size() ? decodedIndex[pc] : DECODED_NONE;
+   }
+
+   // the outcome of verify(), shared through the GProgram like Decoded
+   struct Verification {
+      bool                 ok = false;
+      std::string          error;
+      std::vector<int32_t> depth;
+   };
+
+   std::shared_ptr<const Verification> verification;
+
+   // set by a successful verify(); cleared by setCode()
+   bool                            verified = false;
+
+   // operand stack depth at each decoded instruction reached from the start
+   // of the code outside of any CALL; -1 if there is none
+   GView<int32_t>                  verifyDepth;
+
+   // Checks that the code is safe to run in the unchecked interpreter: all
+   // instructions are valid with their operands inside 'code', jump targets
+   // are instruction boundaries (or the end of the code), constant io
+   // addresses are below IO_SIZE, and the operand stack depth is the same on
+   // every path to an instruction and never goes below zero. A CALL target
+   // may take arguments from the stack and leave results on it, as long as
+   // all its RETs agree on how many. On failure, 'error' (if given) says
+   // where and why. Must be called again if the code changes; a GProgram
+   // is only verified once for each configuration of VM.
+   bool verify(std::string* error = nullptr) {
+      decode();
+      verification = program.template derived<Verification>([this] { return verifyCode(); });
+      verified = verification->ok;
+      verifyDepth = GView<int32_t>(verification->depth);
+      if (!verified && error)
+         *error = verification->error;
+      return verified;
+   }
+
+   Verification verifyCode() {
+      Verification v;
+      auto fail = [&](uint64_t pc, const char* what) {
+         v.error = "pc " + std::to_string(pc) + ": " + what;
+         return v;
+      };
+      for (const Instr& in : decoded) {
+         if (in.opcode == OP_SLOW)
+            return fail(in.pc, "invalid instruction");
+         OpLayout layout = opLayout(in.opcode);
+         if (layout.target && in.target == DECODED_NONE && in.addr != code.size())
+            return fail(in.pc, "jump target is not an instruction");
+         // operands that are io addresses: pointers, and the destinations
+         bool dest1 = in.opcode == OP_SET || in.opcode == OP_INC || in.opcode == OP_DEC ||
+                      in.opcode == OP_POP || in.opcode == OP_VPUSH || in.opcode == OP_VPOP ||
+                      (in.opcode >= OP_INCJEQ && in.opcode <= OP_INCJLE);
+         bool dest2 = in.opcode == OP_VPOP;
+         if (((in.kind & IN_PTR1 || dest1) && in.op1 >= IO_SIZE) ||
+             ((in.kind & IN_PTR2 || dest2) && in.op2 >= IO_SIZE))
+            return fail(in.pc, "io address out of range");
+      }
+      // stack effect of each CALL target, found by analysing the code it
+      // reaches until nothing changes; 'low' is the lowest depth it gets to
+      struct Summary {
+         bool    returns = false;
+         int32_t ret = 0;
+         int32_t low = 0;
+      };
+      std::vector<Summary> summary(decoded.size());
+      std::vector<uint32_t> calls;
+      for (const Instr& in : decoded)
+         if (in.opcode == OP_CALL && in.target != DECODED_NONE)
+            calls.push_back(in.target);
+      std::vector<int32_t> depth;
+      std::vector<uint32_t> work;
+      const char* what = nullptr;
+      uint64_t where = 0;
+      // depths of the code reached from 'entry', relative to the depth there;
+      // 'strict' (the program entry) fails on any negative depth
+      auto analyse = [&](uint32_t entry, bool strict, Summary& sum) {
+         depth.assign(decoded.size(), INT32_MIN);
+         auto reach = [&](uint32_t ip, int32_t d) {
+            if (ip >= decoded.size()) // the end of the code
+               return true;
+            if (depth[ip] == INT32_MIN) {
+               depth[ip] = d;
+               work.push_back(ip);
+            }
+            return depth[ip] == d;
+         };
+         auto lower = [&](const Instr& in, int32_t d) {
+            sum.low = std::min(sum.low, d);
+            if (d < 0 && (strict || d < -int32_t(STACK_SIZE))) {
+               what = "stack underflow";
+               where = in.pc;
+               return false;
+            }
+            return true;
+         };
+         work.clear();
+         reach(entry, 0);
+         while (!work.empty()) {
+            uint32_t ip = work.back();
+            work.pop_back();
+            const Instr& in = decoded[ip];
+            int32_t d = depth[ip];
+            OpStack effect = opStack(in.opcode);
+            if (!lower(in, d - effect.pops))
+               return false;
+            d += effect.pushes - effect.pops;
+            if (d > int32_t(STACK_SIZE)) {
+               what = "stack overflow";
+               where = in.pc;
+               return false;
+            }
+            bool next = true;
+            bool ok = true;
+            switch (in.opcode & ~STACK) {
+            case OP_TERM:
+               next = false;
+               break;
+            case OP_RET:
+               next = false;
+               if (!sum.returns) {
+                  sum.returns = true;
+                  sum.ret = d;
+               } else if (sum.ret != d) {
+                  what = "stack depth differs between RETs";
+                  where = in.pc;
+                  return false;
+               }
+               break;
+            case OP_JMP:
+               next = false;
+               ok = reach(in.target, d);
+               break;
+            case OP_JT:
+            case OP_JF:
+            case OP_JFEQ:
+            case OP_JFNE:
+            case OP_JFGT:
+            case OP_JFLT:
+            case OP_JFGE:
+            case OP_JFLE:
+            case OP_INCJEQ:
+            case OP_INCJNE:
+            case OP_INCJGT:
+            case OP_INCJLT:
+            case OP_INCJGE:
+            case OP_INCJLE:
+               ok = reach(in.target, d);
+               break;
+            case OP_CALL:
+               if (in.target == DECODED_NONE) { // the end of the code
+                  next = false;
+                  break;
+               }
+               if (!lower(in, d + summary[in.target].low))
+                  return false;
+               next = summary[in.target].returns;
+               d += summary[in.target].ret;
+               break;
+            }
+            if (ok && next)
+               ok = reach(ip + 1, d);
+            if (!ok) {
+               what = "stack depth differs between paths";
+               where = in.pc;
+               return false;
+            }
+         }
+         return true;
+      };
+      // every pass either finds a RET or lowers a 'low', so this ends
+      for (bool changed = true; changed; ) {
+         changed = false;
+         for (uint32_t entry : calls) {
+            Summary sum;
+            if (!analyse(entry, false, sum))
+               return fail(where, what);
+            Summary& old = summary[entry];
+            if (sum.returns != old.returns || sum.ret != old.ret || sum.low != old.low) {
+               old = sum;
+               changed = true;
+            }
+         }
+      }
+      Summary top;
+      if (!analyse(0, true, top))
+         return fail(where, what);
+      v.depth.swap(depth);
+      for (int32_t& d : v.depth)
+         if (d == INT32_MIN)
+            d = -1;
+      v.ok = true;
+      return v;
+   }
+
+   // operand shapes of a quickened instruction
+   enum : uint8_t {
+      Q_IMM  = 0,  // constant: an immediate (decodeOperand has already folded @0 into one)
+      Q_IO   = 1,  // io cell at a constant address in [3, IO_SIZE)
+      Q_R    = 2,  // @1
+      Q_S    = 3,  // @2
+      Q_NONE = 4   // anything else: the instruction runs through step()
+   };
+
+   static constexpr uint16_t quickKey(uint8_t opcode, uint8_t s1 = Q_IMM, uint8_t s2 = Q_IMM) {
+      return opcode << 4 | s1 << 2 | s2;
+   }
+
+   static constexpr uint16_t QUICK_NONE = 0xFFFF; // hasn't run yet
+   static constexpr uint16_t QUICK_STEP = 0xFFFE; // runs through step()
+
+   // quickened form of the instruction at a code address (ENGINE_QUICK): the
+   // opcode together with the shapes of its operands, whose values were read
+   // once when the instruction first ran
+   struct Quick {
+      uint16_t key;     // quickKey(), QUICK_NONE or QUICK_STEP
+      uint16_t addr;    // jump address, if the opcode has a target
+      uint32_t next;    // address of the following instruction
+      uint64_t a;       // first operand: the constant (Q_IMM) or the io address (Q_IO)
+      uint64_t b;       // second operand, the same way
+   };
+
+   // the program as the quick engine runs it, one record per code address,
+   // filled in as execution reaches each address; cleared by setCode()
+   std::vector<Quick>              quick;
+
+private:
+
+   // true if io is equal to basePages outside the dirty lines and registers
+   bool hasBase() const { return !dirtyAll && basePages.size() == Snapshot::PAGES; }
+
+   // true if a line of snapshot page i was written since the base (the
+   // registers always count as written)
+   bool pageWritten(uint64_t i) const {
+      uint64_t lines;
+      std::memcpy(&lines, dirty + i * PAGE_LINES, 8);
+      return lines || i * Snapshot::PAGE_SIZE < REG_SIZE;
+   }
+
+   // makes 'snap', which io is now equal to, the base
+   void rebase(const Snapshot& snap) {
+      if (basePages != snap.pages)
+         basePages = snap.pages;
+      std::memset(dirty, 0, sizeof(dirty));
+      dirtyAll = false;
+      zeroed = false;
+   }
+
+   // copies the io line starting at cell 'first' from 'from' to 'to'; a
+   // whole line is a fixed-size copy the compiler does inline
+   static void copyLine(uint64_t* to, const uint64_t* from, uint64_t first) {
+      if (first + IO_LINE <= IO_SIZE)
+         std::memcpy(to, from, sizeof(uint64_t) * IO_LINE);
+      else if (first < IO_SIZE)
+         std::memcpy(to, from, sizeof(uint64_t) * (IO_SIZE - first));
+   }
+
+   // copies snapshot page i to io
+   void copyPage(const uint64_t* page, uint64_t i) {
+      uint64_t first = i * Snapshot::PAGE_SIZE;
+      std::memcpy(&(io[first]), page, sizeof(uint64_t) * std::min(Snapshot::PAGE_SIZE, IO_SIZE - first));
+   }
+
+   // copies the lines of snapshot page i that were written since the base
+   // (the page of the base and of 'page' being the same) to io
+   void copyWrittenLines(const uint64_t* page, uint64_t i) {
+      if (!pageWritten(i))
+         return;
+      for (uint64_t line = 0; line < PAGE_LINES; ++line) {
+         uint64_t first = i * Snapshot::PAGE_SIZE + line * IO_LINE;
+         if (dirty[i * PAGE_LINES + line] || first < REG_SIZE)
+            copyLine(&(io[first]), page + line * IO_LINE, first);
+      }
+   }
+
+   // puts the n values at 'values' on the operand stack, bottom first
+   void restoreStack(const uint64_t* values, size_t n) {
+      stack.n = std::min<size_t>(n, STACK_SIZE);
+      std::memcpy(stack.slot + 1, values, sizeof(uint64_t) * stack.n);
+   }
+
+   // PC, R and S while the interpreter runs. They are kept in a local so the
+   // compiler can hold them in machine registers instead of storing every PC++
+   // through io[0]; get() and put() redirect @0, @1 and @2 to them, and they
+   // are written back to io[0..2] for CALL, RET, HOST, tracing and on exit.
+   // The decoded engine doesn't advance PC operand by operand and works on
+   // io[] directly.
+   //
+   // The top of the operand stack is cached the same way: 'tos' is the value
+   // at sp - 1, and stack.slot[sp] is only written when a push buries it.
+   struct Regs {
+      uint64_t pc, r, s;
+      uint64_t tos;
+      size_t   sp;
+   };
+
+   void loadRegs(Regs& regs) {
+      regs.pc = PC;
+      regs.r = R;
+      regs.s = S;
+      regs.sp = stack.n;
+      regs.tos = stack.slot[regs.sp];
+   }
+
+   void storeRegs(const Regs& regs) {
+      PC = regs.pc;
+      R = regs.r;
+      S = regs.s;
+      stack.n = regs.sp;
+      stack.slot[regs.sp] = regs.tos;
+   }
+
+#if GVM_COMPUTED_GOTO
+#define GVM_OP(label, op) case op: label:
+#define GVM_DEFAULT(label) default: label:
+#define GVM_NEXT if (Threaded) { GVM_DISPATCH(); } else break
+#else
+#define GVM_OP(label, op) case op:
+#define GVM_DEFAULT(label) default:
+#define GVM_NEXT break
+#endif
+
+   // the instruction event, after the opcode byte has been read
+#define GVM_TRACE() Hooks::instruction(*this, regs.pc - 1, opcode, regs.r, regs.sp)
+
+   // replicated at the end of every handler of the threaded interpreter
+#define GVM_DISPATCH()                          \
+   do {                                         \
+      if (term || regs.pc >= code.size())       \
+         goto done;                             \
+      if (overLimit(limit)) {                   \
+         term = ERR_OPLIMIT;                    \
+         goto done;                             \
+      }                                         \
+      opcode = code[regs.pc++];                 \
+      GVM_TRACE();                              \
+      goto *dispatch[opcode];                   \
+   } while (0)
+
+   // runs the interpreter without the checks verify() makes redundant if
+   // the run starts where verify() has checked it can
+   template <bool Threaded>
+   void runInterpreter(uint64_t limit) {
+      uint32_t ip = locate(PC);
+      if (verified && context.empty() &&
+          (PC >= code.size() || (ip != DECODED_NONE && verifyDepth[ip] >= 0 && stack.size() >= size_t(verifyDepth[ip]))))
+         interpret<false, Threaded, true>(limit);
+      else
+         interpret<false, Threaded, false>(limit);
+   }
+
+   // io write from the interpreter; writing @0 is a jump that verify()
+   // didn't check, so it ends an unchecked run once the instruction is done
+#define GVM_PUT(index, value)                   \
+   do {                                         \
+      uint64_t put_ = (index);                  \
+      uint64_t value_ = (value);                \
+      Hooks::write(*this, put_, value_);        \
+      put(put_, value_, regs);                  \
+      if (Unchecked && put_ == 0)               \
+         jumped = true;                         \
+   } while (0)
+
+   // the end of an instruction that writes io
+#define GVM_PUT_NEXT                            \
+      if (Unchecked && jumped)                  \
+         goto unchecked_exit;                   \
+      GVM_NEXT
+
+   // HOST n, with n in op1; like HOST, a call that moves PC or the stack
+   // ends an unchecked run
+#define GVM_HOSTN()                             \
+   {                                            \
+      uint64_t pc = regs.pc;                    \
+      size_t sp = regs.sp;                      \
+      size_t frames = context.size();           \
+      Hooks::host(*this, op1, regs.r);          \
+      storeRegs(regs);                          \
+      bool found = hostCall(op1);               \
+      loadRegs(regs);                           \
+      if (!found)                               \
+         term = ERR_HOSTCALL;                   \
+      else if (Unchecked && (regs.pc != pc || regs.sp != sp || context.size() != frames)) \
+         goto unchecked_exit;                   \
+      GVM_NEXT;                                 \
+   }
+
+   // superinstruction handlers, one per comparison or operator
+#define GVM_PUSHED(label, op, expr)             \
+   GVM_OP(label, op | PUSHED)                   \
+      op1 = read<Unchecked, Hooks>(regs);              \
+      op2 = read<Unchecked, Hooks>(regs);              \
+      push(expr, regs);                         \
+      GVM_NEXT;
+
+#define GVM_BRANCH(cond)                        \
+      if (cond) {                               \
+         regs.pc = read<Unchecked, Hooks>(regs, true); \
+         GVM_NEXT;                              \
+      } else {                                  \
+         regs.pc += 2;                          \
+         GVM_NEXT;                              \
+      }
+
+#define GVM_JF(label, op, cmp)                  \
+   GVM_OP(label, op)                            \
+      op1 = read<Unchecked, Hooks>(regs);              \
+      op2 = read<Unchecked, Hooks>(regs);              \
+      GVM_BRANCH(!(op1 cmp op2))                \
+   GVM_OP(label##_stack, op | STACK)            \
+      op2 = pop<Unchecked>(regs);               \
+      op1 = pop<Unchecked>(regs);               \
+      GVM_BRANCH(!(op1 cmp op2))
+
+   // incrementing @0 moves PC before the bound and the jump address are
+   // read, so an unchecked run reads them with the checks
+#define GVM_INCJ(label, op, cmp)                \
+   GVM_OP(label, op)                            \
+      op1 = read<Unchecked, Hooks>(regs);              \
+      GVM_PUT(op1, get(op1, regs) + 1);         \
+      if (Unchecked && jumped) {                \
+         op2 = read<false, Hooks>(regs);        \
+         regs.r = get(op1, regs) cmp op2;       \
+         regs.pc = regs.r ? read<false, Hooks>(regs, true) : regs.pc + 2; \
+         goto unchecked_exit;                   \
+      }                                         \
+      op2 = read<Unchecked, Hooks>(regs);              \
+      regs.r = get(op1, regs) cmp op2;          \
+      GVM_BRANCH(regs.r)
 
-#ifdef DEBUG
-   bool debug;
+   // the bytecode interpreter; Step executes a single instruction without
+   // counting it, Threaded dispatches through the 'dispatch' label table.
+   // Unchecked (verified code) leaves out the ERR_CODESIZE and ERR_UNDERFLOW
+   // checks and the ERR_SEGFAULT check of constant addresses. A jump that
+   // verify() couldn't see, by writing @0 or from the host callback, goes
+   // on in the checked interpreter.
+   template <bool Step, bool Threaded, bool Unchecked = false, class Hooks = GVMNoHooks>
+   void interpret(uint64_t limit) {
+#if GVM_COMPUTED_GOTO
+      static void* const dispatch[256] = {
+         &&op_nop, &&op_term, &&op_set, &&op_jmp,
+         &&op_add, &&op_sub, &&op_mul, &&op_div,
+         &&op_mod, &&op_or, &&op_andl, &&op_xor,
+         &&op_not, &&op_shl, &&op_shr, &&op_inc,
+         &&op_dec, &&op_push, &&op_pop, &&op_and,
+         &&op_host, &&op_vpush, &&op_vpop, &&op_call,
+         &&op_ret, &&op_jf, &&op_jt, &&op_eq,
+         &&op_ne, &&op_gt, &&op_lt, &&op_ge,
+         &&op_le, &&op_neg, &&op_orl, &&op_jfeq,
+         &&op_jfne, &&op_jfgt, &&op_jflt, &&op_jfge,
+         &&op_jfle, &&op_incjeq, &&op_incjne, &&op_incjgt,
+         &&op_incjlt, &&op_incjge, &&op_incjle, &&op_hostn,
+         &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid,
+         &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid,
+         &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid,
+         &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid,
+         &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid,
+         &&op_padd, &&op_psub, &&op_pmul, &&op_pdiv,
+         &&op_pmod, &&op_por, &&op_invalid, &&op_pxor,
+         &&op_invalid, &&op_pshl, &&op_pshr, &&op_invalid,
+         &&op_invalid, &&op_invalid, &&op_invalid, &&op_pand,
+         &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid,
+         &&op_invalid, &&op_invalid, &&op_invalid, &&op_peq,
+         &&op_pne, &&op_pgt, &&op_plt, &&op_pge,
+         &&op_ple, &&op_invalid, &&op_porl, &&op_invalid,
+         &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid,
+         &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid,
+         &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid,
+         &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid,
+         &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid,
+         &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid,
+         &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid,
+         &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid,
+         &&op_add_stack, &&op_sub_stack, &&op_mul_stack, &&op_div_stack,
+         &&op_mod_stack, &&op_or_stack, &&op_andl_stack, &&op_xor_stack,
+         &&op_not_stack, &&op_shl_stack, &&op_shr_stack, &&op_invalid,
+         &&op_invalid, &&op_invalid, &&op_invalid, &&op_and_stack,
+         &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid,
+         &&op_invalid, &&op_jf_stack, &&op_jt_stack, &&op_eq_stack,
+         &&op_ne_stack, &&op_gt_stack, &&op_lt_stack, &&op_ge_stack,
+         &&op_le_stack, &&op_neg_stack, &&op_orl_stack, &&op_jfeq_stack,
+         &&op_jfne_stack, &&op_jfgt_stack, &&op_jflt_stack, &&op_jfge_stack,
+         &&op_jfle_stack, &&op_invalid, &&op_invalid, &&op_invalid,
+         &&op_invalid, &&op_invalid, &&op_invalid, &&op_hostn_stack,
+         &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid,
+         &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid,
+         &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid,
+         &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid,
+         &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid,
+         &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid,
+         &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid,
+         &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid,
+         &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid,
+         &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid,
+         &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid,
+         &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid,
+         &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid,
+         &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid,
+         &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid,
+         &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid,
+         &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid,
+         &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid,
+         &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid,
+         &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid
+      };
 #endif
-
-   GVM(uint64_t (&io)[IO_SIZE], std::vector<uint8_t>& code)
-      : io(io), code(code), hostCallback(nullptr)
-      {
-#ifdef DEBUG
-         debug = false;
+      uint64_t op1, op2;
+      bool jumped = false; // an unchecked instruction wrote @0
+      Regs regs;
+      loadRegs(regs);
+      while (!term && regs.pc < code.size()) {
+         if (!Step && overLimit(limit)) {
+            term = ERR_OPLIMIT;
+            break;
+         }
+         opcode = code[regs.pc++];
+         GVM_TRACE();
+#if GVM_COMPUTED_GOTO
+         if (Threaded)
+            goto *dispatch[opcode];
 #endif
+         switch (opcode) {
+         GVM_OP(op_nop, OP_NOP)
+            GVM_NEXT;
+         GVM_OP(op_term, OP_TERM)
+            regs.pc = UINT64_MAX;
+            GVM_NEXT;
+         GVM_OP(op_set, OP_SET)
+            op1 = read<Unchecked, Hooks>(regs);
+            op2 = read<Unchecked, Hooks>(regs);
+            GVM_PUT(op1, op2);
+            GVM_PUT_NEXT;
+         GVM_OP(op_jmp, OP_JMP)
+            op1 = read<Unchecked, Hooks>(regs, true);
+            regs.pc = op1;
+            GVM_NEXT;
+         GVM_OP(op_add, OP_ADD)
+            op1 = read<Unchecked, Hooks>(regs);
+            op2 = read<Unchecked, Hooks>(regs);
+            regs.r = op1 + op2;
+            GVM_NEXT;
+         GVM_OP(op_add_stack, OP_ADD | STACK)
+            op2 = pop<Unchecked>(regs);
+            op1 = pop<Unchecked>(regs);
+            push(op1 + op2, regs);
+            GVM_NEXT;
+         GVM_OP(op_sub, OP_SUB)
+            op1 = read<Unchecked, Hooks>(regs);
+            op2 = read<Unchecked, Hooks>(regs);
+            regs.r = op1 - op2;
+            if (Checks::negNum && op1 < op2)
+               term = ERR_NEGNUM;
+            GVM_NEXT;
+         GVM_OP(op_sub_stack, OP_SUB | STACK)
+            op2 = pop<Unchecked>(regs);
+            op1 = pop<Unchecked>(regs);
+            push(op1 - op2, regs);
+            if (Checks::negNum && op1 < op2)
+               term = ERR_NEGNUM;
+            GVM_NEXT;
+         GVM_OP(op_mul, OP_MUL)
+            op1 = read<Unchecked, Hooks>(regs);
+            op2 = read<Unchecked, Hooks>(regs);
+            regs.r = op1 * op2;
+            GVM_NEXT;
+         GVM_OP(op_mul_stack, OP_MUL | STACK)
+            op2 = pop<Unchecked>(regs);
+            op1 = pop<Unchecked>(regs);
+            push(op1 * op2, regs);
+            GVM_NEXT;
+         GVM_OP(op_div, OP_DIV)
+            op1 = read<Unchecked, Hooks>(regs);
+            op2 = read<Unchecked, Hooks>(regs);
+            if (op2 != 0) {
+               regs.r = op1 / op2;
+               GVM_NEXT;
+            } else {
+               term = ERR_DIVZERO;
+               GVM_NEXT;
+            }
+         GVM_OP(op_div_stack, OP_DIV | STACK)
+            op2 = pop<Unchecked>(regs);
+            op1 = pop<Unchecked>(regs);
+            if (op2 != 0) {
+               push(op1 / op2, regs);
+               GVM_NEXT;
+            } else {
+               term = ERR_DIVZERO;
+               GVM_NEXT;
+            }
+         GVM_OP(op_mod, OP_MOD)
+            op1 = read<Unchecked, Hooks>(regs);
+            op2 = read<Unchecked, Hooks>(regs);
+            if (op2 != 0) {
+               regs.r = op1 % op2;
+               GVM_NEXT;
+            } else {
+               term = ERR_DIVZERO;
+               GVM_NEXT;
+            }
+         GVM_OP(op_mod_stack, OP_MOD | STACK)
+            op2 = pop<Unchecked>(regs);
+            op1 = pop<Unchecked>(regs);
+            if (op2 != 0) {
+               push(op1 % op2, regs);
+               GVM_NEXT;
+            } else {
+               term = ERR_DIVZERO;
+               GVM_NEXT;
+            }
+         GVM_OP(op_or, OP_OR)
+            op1 = read<Unchecked, Hooks>(regs);
+            op2 = read<Unchecked, Hooks>(regs);
+            regs.r = op1 | op2;
+            GVM_NEXT;
+         GVM_OP(op_or_stack, OP_OR | STACK)
+            op2 = pop<Unchecked>(regs);
+            op1 = pop<Unchecked>(regs);
+            push(op1 | op2, regs);
+            GVM_NEXT;
+         GVM_OP(op_andl, OP_ANDL)
+            op1 = read<Unchecked, Hooks>(regs);
+            op2 = read<Unchecked, Hooks>(regs);
+            regs.r = op1 && op2;
+            GVM_NEXT;
+         GVM_OP(op_andl_stack, OP_ANDL | STACK)
+            op2 = pop<Unchecked>(regs);
+            op1 = pop<Unchecked>(regs);
+            regs.r = op1 && op2;
+            GVM_NEXT;
+         GVM_OP(op_xor, OP_XOR)
+            op1 = read<Unchecked, Hooks>(regs);
+            op2 = read<Unchecked, Hooks>(regs);
+            regs.r = op1 ^ op2;
+            GVM_NEXT;
+         GVM_OP(op_xor_stack, OP_XOR | STACK)
+            op2 = pop<Unchecked>(regs);
+            op1 = pop<Unchecked>(regs);
+            push(op1 ^ op2, regs);
+            GVM_NEXT;
+         GVM_OP(op_not, OP_NOT)
+            op1 = read<Unchecked, Hooks>(regs);
+            regs.r = !op1;
+            GVM_NEXT;
+         GVM_OP(op_not_stack, OP_NOT | STACK)
+            op1 = pop<Unchecked>(regs);
+            push(!op1, regs);
+            GVM_NEXT;
+         GVM_OP(op_shl, OP_SHL)
+            op1 = read<Unchecked, Hooks>(regs);
+            op2 = read<Unchecked, Hooks>(regs);
+            regs.r = op1 << op2;
+            GVM_NEXT;
+         GVM_OP(op_shl_stack, OP_SHL | STACK)
+            op2 = pop<Unchecked>(regs);
+            op1 = pop<Unchecked>(regs);
+            push(op1 << op2, regs);
+            GVM_NEXT;
+         GVM_OP(op_shr, OP_SHR)
+            op1 = read<Unchecked, Hooks>(regs);
+            op2 = read<Unchecked, Hooks>(regs);
+            regs.r = op1 >> op2;
+            GVM_NEXT;
+         GVM_OP(op_shr_stack, OP_SHR | STACK)
+            op2 = pop<Unchecked>(regs);
+            op1 = pop<Unchecked>(regs);
+            push(op1 >> op2, regs);
+            GVM_NEXT;
+         GVM_OP(op_inc, OP_INC)
+            op1 = read<Unchecked, Hooks>(regs);
+            GVM_PUT(op1, get(op1, regs) + 1);
+            GVM_PUT_NEXT;
+         GVM_OP(op_dec, OP_DEC) // doesn't do < 0 check
+            op1 = read<Unchecked, Hooks>(regs);
+            GVM_PUT(op1, get(op1, regs) - 1);
+            GVM_PUT_NEXT;
+         GVM_OP(op_push, OP_PUSH)
+            op1 = read<Unchecked, Hooks>(regs);
+            push(op1, regs);
+            GVM_NEXT;
+         GVM_OP(op_pop, OP_POP)
+            op1 = read<Unchecked, Hooks>(regs);
+            GVM_PUT(op1, pop<Unchecked>(regs));
+            GVM_PUT_NEXT;
+         GVM_OP(op_and, OP_AND)
+            op1 = read<Unchecked, Hooks>(regs);
+            op2 = read<Unchecked, Hooks>(regs);
+            regs.r = op1 & op2;
+            GVM_NEXT;
+         GVM_OP(op_and_stack, OP_AND | STACK)
+            op2 = pop<Unchecked>(regs);
+            op1 = pop<Unchecked>(regs);
+            push(op1 & op2, regs);
+            GVM_NEXT;
+         GVM_OP(op_host, OP_HOST) {
+            uint64_t pc = regs.pc;
+            size_t sp = regs.sp;
+            size_t frames = context.size();
+            Hooks::host(*this, 0, regs.r);
+            storeRegs(regs);
+            callHost();
+            loadRegs(regs);
+            if (Unchecked && (regs.pc != pc || regs.sp != sp || context.size() != frames))
+               goto unchecked_exit;
+            GVM_NEXT;
+         }
+         GVM_OP(op_hostn, OP_HOSTN)
+            op1 = read<Unchecked, Hooks>(regs);
+            GVM_HOSTN()
+         GVM_OP(op_hostn_stack, OP_HOSTN | STACK)
+            op1 = pop<Unchecked>(regs);
+            GVM_HOSTN()
+         GVM_OP(op_vpush, OP_VPUSH)
+            op1 = read<Unchecked, Hooks>(regs);
+            op2 = read<Unchecked, Hooks>(regs);
+            GVM_PUT(op1, get(op1, regs) + 1);
+            GVM_PUT(get(op1, regs), op2);
+            GVM_PUT_NEXT;
+         GVM_OP(op_vpop, OP_VPOP)
+            op1 = read<Unchecked, Hooks>(regs);
+            op2 = read<Unchecked, Hooks>(regs);
+            GVM_PUT(op2, get(op1, regs));
+            GVM_PUT(op1, get(op1, regs) - 1);
+            GVM_PUT_NEXT;
+         GVM_OP(op_call, OP_CALL) {
+            op1 = read<Unchecked, Hooks>(regs, true); // function address
+            Hooks::call(*this, op1, context.size());
+            registers_t saved;
+            storeRegs(regs);
+            memcpy(saved.data(), &(io[0]), sizeof(uint64_t) * REG_SIZE);
+            context.push_back(saved); // save all registers, including PC for return
+            regs.pc = op1;
+            GVM_NEXT;
+         }
+         GVM_OP(op_ret, OP_RET)
+            op1 = read<Unchecked, Hooks>(regs); // convenience return value
+            if (context.size() == 0) {
+               term = ERR_RET;
+               GVM_NEXT;
+            } else {
+               storeRegs(regs); // for the stack
+               memcpy(&(io[0]), context.back().data(), sizeof(uint64_t) * REG_SIZE);
+               context.pop_back();
+               loadRegs(regs);
+               regs.r = op1; // R is assigned the return value instead of restored
+               Hooks::ret(*this, regs.pc, context.size());
+               GVM_NEXT;
+            }
+         GVM_OP(op_jf, OP_JF)
+            op1 = read<Unchecked, Hooks>(regs);
+            if (!op1) {
+               regs.pc = read<Unchecked, Hooks>(regs, true);
+               GVM_NEXT;
+            } else {
+               regs.pc += 2;
+               GVM_NEXT;
+            }
+         GVM_OP(op_jf_stack, OP_JF | STACK)
+            op1 = pop<Unchecked>(regs);
+            if (!op1) {
+               regs.pc = read<Unchecked, Hooks>(regs, true);
+               GVM_NEXT;
+            } else {
+               regs.pc += 2;
+               GVM_NEXT;
+            }
+         GVM_OP(op_jt, OP_JT)
+            op1 = read<Unchecked, Hooks>(regs);
+            if (op1) {
+               regs.pc = read<Unchecked, Hooks>(regs, true);
+               GVM_NEXT;
+            } else {
+               regs.pc += 2;
+               GVM_NEXT;
+            }
+         GVM_OP(op_jt_stack, OP_JT | STACK)
+            op1 = pop<Unchecked>(regs);
+            if (op1) {
+               regs.pc = read<Unchecked, Hooks>(regs, true);
+               GVM_NEXT;
+            } else {
+               regs.pc += 2;
+               GVM_NEXT;
+            }
+         GVM_OP(op_eq, OP_EQ)
+            op1 = read<Unchecked, Hooks>(regs);
+            op2 = read<Unchecked, Hooks>(regs);
+            regs.r = op1 == op2;
+            GVM_NEXT;
+         GVM_OP(op_eq_stack, OP_EQ | STACK)
+            op2 = pop<Unchecked>(regs);
+            op1 = pop<Unchecked>(regs);
+            push(op1 == op2, regs);
+            GVM_NEXT;
+         GVM_OP(op_ne, OP_NE)
+            op1 = read<Unchecked, Hooks>(regs);
+            op2 = read<Unchecked, Hooks>(regs);
+            regs.r = op1 != op2;
+            GVM_NEXT;
+         GVM_OP(op_ne_stack, OP_NE | STACK)
+            op2 = pop<Unchecked>(regs);
+            op1 = pop<Unchecked>(regs);
+            push(op1 != op2, regs);
+            GVM_NEXT;
+         GVM_OP(op_gt, OP_GT)
+            op1 = read<Unchecked, Hooks>(regs);
+            op2 = read<Unchecked, Hooks>(regs);
+            regs.r = op1 > op2;
+            GVM_NEXT;
+         GVM_OP(op_gt_stack, OP_GT | STACK)
+            op2 = pop<Unchecked>(regs);
+            op1 = pop<Unchecked>(regs);
+            push(op1 > op2, regs);
+            GVM_NEXT;
+         GVM_OP(op_lt, OP_LT)
+            op1 = read<Unchecked, Hooks>(regs);
+            op2 = read<Unchecked, Hooks>(regs);
+            regs.r = op1 < op2;
+            GVM_NEXT;
+         GVM_OP(op_lt_stack, OP_LT | STACK)
+            op2 = pop<Unchecked>(regs);
+            op1 = pop<Unchecked>(regs);
+            push(op1 < op2, regs);
+            GVM_NEXT;
+         GVM_OP(op_ge, OP_GE)
+            op1 = read<Unchecked, Hooks>(regs);
+            op2 = read<Unchecked, Hooks>(regs);
+            regs.r = op1 >= op2;
+            GVM_NEXT;
+         GVM_OP(op_ge_stack, OP_GE | STACK)
+            op2 = pop<Unchecked>(regs);
+            op1 = pop<Unchecked>(regs);
+            push(op1 >= op2, regs);
+            GVM_NEXT;
+         GVM_OP(op_le, OP_LE)
+            op1 = read<Unchecked, Hooks>(regs);
+            op2 = read<Unchecked, Hooks>(regs);
+            regs.r = op1 <= op2;
+            GVM_NEXT;
+         GVM_OP(op_le_stack, OP_LE | STACK)
+            op2 = pop<Unchecked>(regs);
+            op1 = pop<Unchecked>(regs);
+            push(op1 <= op2, regs);
+            GVM_NEXT;
+         GVM_OP(op_neg, OP_NEG)
+            op1 = read<Unchecked, Hooks>(regs);
+            regs.r = ~op1;
+            GVM_NEXT;
+         GVM_OP(op_neg_stack, OP_NEG | STACK)
+            op1 = pop<Unchecked>(regs);
+            push(~op1, regs);
+            GVM_NEXT;
+         GVM_OP(op_orl, OP_ORL)
+            op1 = read<Unchecked, Hooks>(regs);
+            op2 = read<Unchecked, Hooks>(regs);
+            regs.r = op1 || op2;
+            GVM_NEXT;
+         GVM_OP(op_orl_stack, OP_ORL | STACK)
+            op2 = pop<Unchecked>(regs);
+            op1 = pop<Unchecked>(regs);
+            push(op1 || op2, regs);
+            GVM_NEXT;
+         GVM_PUSHED(op_padd, OP_ADD, op1 + op2)
+         GVM_OP(op_psub, OP_SUB | PUSHED)
+            op1 = read<Unchecked, Hooks>(regs);
+            op2 = read<Unchecked, Hooks>(regs);
+            push(op1 - op2, regs);
+            if (Checks::negNum && op1 < op2)
+               term = ERR_NEGNUM;
+            GVM_NEXT;
+         GVM_PUSHED(op_pmul, OP_MUL, op1 * op2)
+         GVM_OP(op_pdiv, OP_DIV | PUSHED)
+            op1 = read<Unchecked, Hooks>(regs);
+            op2 = read<Unchecked, Hooks>(regs);
+            if (op2 != 0) {
+               push(op1 / op2, regs);
+               GVM_NEXT;
+            } else {
+               term = ERR_DIVZERO;
+               GVM_NEXT;
+            }
+         GVM_OP(op_pmod, OP_MOD | PUSHED)
+            op1 = read<Unchecked, Hooks>(regs);
+            op2 = read<Unchecked, Hooks>(regs);
+            if (op2 != 0) {
+               push(op1 % op2, regs);
+               GVM_NEXT;
+            } else {
+               term = ERR_DIVZERO;
+               GVM_NEXT;
+            }
+         GVM_PUSHED(op_por, OP_OR, op1 | op2)
+         GVM_PUSHED(op_pxor, OP_XOR, op1 ^ op2)
+         GVM_PUSHED(op_pshl, OP_SHL, op1 << op2)
+         GVM_PUSHED(op_pshr, OP_SHR, op1 >> op2)
+         GVM_PUSHED(op_pand, OP_AND, op1 & op2)
+         GVM_PUSHED(op_peq, OP_EQ, op1 == op2)
+         GVM_PUSHED(op_pne, OP_NE, op1 != op2)
+         GVM_PUSHED(op_pgt, OP_GT, op1 > op2)
+         GVM_PUSHED(op_plt, OP_LT, op1 < op2)
+         GVM_PUSHED(op_pge, OP_GE, op1 >= op2)
+         GVM_PUSHED(op_ple, OP_LE, op1 <= op2)
+         GVM_PUSHED(op_porl, OP_ORL, op1 || op2)
+         GVM_JF(op_jfeq, OP_JFEQ, ==)
+         GVM_JF(op_jfne, OP_JFNE, !=)
+         GVM_JF(op_jfgt, OP_JFGT, >)
+         GVM_JF(op_jflt, OP_JFLT, <)
+         GVM_JF(op_jfge, OP_JFGE, >=)
+         GVM_JF(op_jfle, OP_JFLE, <=)
+         GVM_INCJ(op_incjeq, OP_INCJEQ, ==)
+         GVM_INCJ(op_incjne, OP_INCJNE, !=)
+         GVM_INCJ(op_incjgt, OP_INCJGT, >)
+         GVM_INCJ(op_incjlt, OP_INCJLT, <)
+         GVM_INCJ(op_incjge, OP_INCJGE, >=)
+         GVM_INCJ(op_incjle, OP_INCJLE, <=)
+         GVM_DEFAULT(op_invalid)
+            term = ERR_OPCODE;
+            GVM_NEXT;
+         }
+         if (Step)
+            break;
       }
-
-   GVM(uint64_t (&io)[IO_SIZE], std::vector<uint8_t>& code, const HostCallback& hostCallback)
-      : io(io), code(code), hostCallback(hostCallback)
-      {
-#ifdef DEBUG
-         debug = false;
+#if GVM_COMPUTED_GOTO
+   done:
 #endif
-      }
+      storeRegs(regs);
+      return;
+   unchecked_exit:
+      storeRegs(regs);
+      interpret<Step, Threaded, false, Hooks>(limit);
+   }
 
-#ifdef DEBUG
-   void setDebug(bool newDebug) { debug = newDebug; }
-#endif
+#undef GVM_OP
+#undef GVM_PUT
+#undef GVM_PUT_NEXT
+#undef GVM_PUSHED
+#undef GVM_BRANCH
+#undef GVM_JF
+#undef GVM_INCJ
+#undef GVM_HOSTN
+#undef GVM_DEFAULT
+#undef GVM_NEXT
+#undef GVM_TRACE
+#undef GVM_DISPATCH
 
-   void setCode(std::vector<uint8_t>& newCode) { code = newCode; }
+   // value of a decoded operand
+   uint64_t operand(uint64_t value, bool ptr) { return ptr ? get(value) : value; }
 
-   void setHostCallback(const HostCallback& newHostCallback) { hostCallback = newHostCallback; }
+   // superinstructions in the decoded engine, as in interpret()
+#define GVM_PUSHED(op, expr)                    \
+   case op | PUSHED:                            \
+      op1 = operand(in.op1, in.kind & IN_PTR1); \
+      op2 = operand(in.op2, in.kind & IN_PTR2); \
+      push(expr);                               \
+      break;
 
-   void run(uint64_t limit = DEFAULT_OP_LIMIT) {
-      term = ERR_OK;
-      count = 0;
+#define GVM_BRANCH(cond)                        \
+      if (cond) {                               \
+         PC = in.addr;                          \
+         ip = Blocks ? charge(in.target, limit) : in.target; \
+         continue;                              \
+      }                                         \
+      if (Blocks) {                             \
+         ip = charge(locate(PC), limit);        \
+         continue;                              \
+      }                                         \
+      break;
+
+#define GVM_JF(op, cmp)                         \
+   case op:                                     \
+      op1 = operand(in.op1, in.kind & IN_PTR1); \
+      op2 = operand(in.op2, in.kind & IN_PTR2); \
+      GVM_BRANCH(!(op1 cmp op2))                \
+   case op | STACK:                             \
+      op2 = pop();                              \
+      op1 = pop();                              \
+      GVM_BRANCH(!(op1 cmp op2))
+
+#define GVM_INCJ(op, cmp)                       \
+   case op:                                     \
+      if (in.kind & IN_STEP)                    \
+         goto slow;                             \
+      op1 = operand(in.op1, in.kind & IN_PTR1); \
+      ++cell(op1);                              \
+      op2 = operand(in.op2, in.kind & IN_PTR2); \
+      R = get(op1) cmp op2;                     \
+      GVM_BRANCH(R)
+
+   // Blocks: instead of counting every instruction, the op limit is charged
+   // when execution enters a run of instructions (see decodedCost), for the
+   // whole run at once; instructions that a run doesn't get to execute are
+   // refunded, so 'count' is exact again when run() returns
+   template <bool Blocks>
+   void runDecoded(uint64_t limit) {
+      if (decodedIndex.size() != code.size())
+         decode();
       uint64_t op1, op2;
+      uint32_t ip = locate(PC);
+      if (Blocks)
+         ip = charge(ip, limit);
       while (!term && PC < code.size()) {
-         if (++count > limit) {
+         if (ip == DECODED_NONE) {
+            // jumped into the middle of an instruction
+            if (overLimit(limit)) {
+               term = ERR_OPLIMIT;
+               break;
+            }
+            step();
+            ip = locate(PC);
+            continue;
+         }
+         const Instr& in = decoded[ip];
+         if (!Blocks && overLimit(limit)) {
             term = ERR_OPLIMIT;
             break;
          }
-         opcode = code[PC++];
-#ifdef DEBUG
-         if (debug) {
-            std::cout << "PC=" << std::to_string(PC - 1) << " R=" << std::to_string(R) << " OPC=" << std::to_string(opcode) << " PEEK=[";
-            for (int i=1; i<5; ++i)
-               if (PC + i < code.size()) {
-                  if (i > 1)
-                     std::cout << ", ";
-                  std::cout << std::to_string(code[PC + i]);
-               }
-            std::cout << "] STK(" << stack.size() << "): ";
-            for (const auto& element : stack)
-               std::cout << element << " ";
-            std::cout << std::endl;
-         }
-#endif
-         switch (opcode) {
+         opcode = in.opcode;
+         PC = in.next;
+         switch (in.opcode) {
+         case OP_SLOW:
+         slow:
+            PC = in.pc;
+            step();
+            if (Blocks) {
+               ip = charge(locate(PC), limit);
+               continue;
+            }
+            break;
          case OP_NOP:
             break;
          case OP_TERM:
             PC = UINT64_MAX;
             break;
          case OP_SET:
-            op1 = read();
-            op2 = read();
-            get(op1) = op2;
+            op1 = operand(in.op1, in.kind & IN_PTR1);
+            op2 = operand(in.op2, in.kind & IN_PTR2);
+            cell(op1) = op2;
             break;
          case OP_JMP:
-            op1 = read(true);
-            PC = op1;
-            break;
+            PC = in.op1;
+            ip = Blocks ? charge(in.target, limit) : in.target;
+            continue;
          case OP_ADD:
-            op1 = read();
-            op2 = read();
+            op1 = operand(in.op1, in.kind & IN_PTR1);
+            op2 = operand(in.op2, in.kind & IN_PTR2);
             R = op1 + op2;
             break;
          case OP_ADD | STACK:
@@ -206,22 +2542,22 @@ public:
             push(op1 + op2);
             break;
          case OP_SUB:
-            op1 = read();
-            op2 = read();
+            op1 = operand(in.op1, in.kind & IN_PTR1);
+            op2 = operand(in.op2, in.kind & IN_PTR2);
             R = op1 - op2;
-            if (op1 < op2)
+            if (Checks::negNum && op1 < op2)
                term = ERR_NEGNUM;
             break;
          case OP_SUB | STACK:
             op2 = pop();
             op1 = pop();
             push(op1 - op2);
-            if (op1 < op2)
+            if (Checks::negNum && op1 < op2)
                term = ERR_NEGNUM;
             break;
          case OP_MUL:
-            op1 = read();
-            op2 = read();
+            op1 = operand(in.op1, in.kind & IN_PTR1);
+            op2 = operand(in.op2, in.kind & IN_PTR2);
             R = op1 * op2;
             break;
          case OP_MUL | STACK:
@@ -230,48 +2566,40 @@ public:
             push(op1 * op2);
             break;
          case OP_DIV:
-            op1 = read();
-            op2 = read();
-            if (op2 != 0) {
+            op1 = operand(in.op1, in.kind & IN_PTR1);
+            op2 = operand(in.op2, in.kind & IN_PTR2);
+            if (op2 != 0)
                R = op1 / op2;
-               break;
-            } else {
+            else
                term = ERR_DIVZERO;
-               break;
-            }
+            break;
          case OP_DIV | STACK:
             op2 = pop();
             op1 = pop();
-            if (op2 != 0) {
+            if (op2 != 0)
                push(op1 / op2);
-               break;
-            } else {
+            else
                term = ERR_DIVZERO;
-               break;
-            }
+            break;
          case OP_MOD:
-            op1 = read();
-            op2 = read();
-            if (op2 != 0) {
+            op1 = operand(in.op1, in.kind & IN_PTR1);
+            op2 = operand(in.op2, in.kind & IN_PTR2);
+            if (op2 != 0)
                R = op1 % op2;
-               break;
-            } else {
+            else
                term = ERR_DIVZERO;
-               break;
-            }
+            break;
          case OP_MOD | STACK:
             op2 = pop();
             op1 = pop();
-            if (op2 != 0) {
+            if (op2 != 0)
                push(op1 % op2);
-               break;
-            } else {
+            else
                term = ERR_DIVZERO;
-               break;
-            }
+            break;
          case OP_OR:
-            op1 = read();
-            op2 = read();
+            op1 = operand(in.op1, in.kind & IN_PTR1);
+            op2 = operand(in.op2, in.kind & IN_PTR2);
             R = op1 | op2;
             break;
          case OP_OR | STACK:
@@ -280,8 +2608,8 @@ public:
             push(op1 | op2);
             break;
          case OP_ANDL:
-            op1 = read();
-            op2 = read();
+            op1 = operand(in.op1, in.kind & IN_PTR1);
+            op2 = operand(in.op2, in.kind & IN_PTR2);
             R = op1 && op2;
             break;
          case OP_ANDL | STACK:
@@ -290,8 +2618,8 @@ public:
             R = op1 && op2;
             break;
          case OP_XOR:
-            op1 = read();
-            op2 = read();
+            op1 = operand(in.op1, in.kind & IN_PTR1);
+            op2 = operand(in.op2, in.kind & IN_PTR2);
             R = op1 ^ op2;
             break;
          case OP_XOR | STACK:
@@ -300,7 +2628,7 @@ public:
             push(op1 ^ op2);
             break;
          case OP_NOT:
-            op1 = read();
+            op1 = operand(in.op1, in.kind & IN_PTR1);
             R = !op1;
             break;
          case OP_NOT | STACK:
@@ -308,8 +2636,8 @@ public:
             push(!op1);
             break;
          case OP_SHL:
-            op1 = read();
-            op2 = read();
+            op1 = operand(in.op1, in.kind & IN_PTR1);
+            op2 = operand(in.op2, in.kind & IN_PTR2);
             R = op1 << op2;
             break;
          case OP_SHL | STACK:
@@ -318,8 +2646,8 @@ public:
             push(op1 << op2);
             break;
          case OP_SHR:
-            op1 = read();
-            op2 = read();
+            op1 = operand(in.op1, in.kind & IN_PTR1);
+            op2 = operand(in.op2, in.kind & IN_PTR2);
             R = op1 >> op2;
             break;
          case OP_SHR | STACK:
@@ -328,24 +2656,24 @@ public:
             push(op1 >> op2);
             break;
          case OP_INC:
-            op1 = read();
-            ++get(op1);
+            op1 = operand(in.op1, in.kind & IN_PTR1);
+            ++cell(op1);
             break;
-         case OP_DEC: // doesn't do < 0 check
-            op1 = read();
-            --get(op1);
+         case OP_DEC:
+            op1 = operand(in.op1, in.kind & IN_PTR1);
+            --cell(op1);
             break;
          case OP_PUSH:
-            op1 = read();
+            op1 = operand(in.op1, in.kind & IN_PTR1);
             push(op1);
             break;
          case OP_POP:
-            op1 = read();
-            get(op1) = pop();
+            op1 = operand(in.op1, in.kind & IN_PTR1);
+            cell(op1) = pop();
             break;
          case OP_AND:
-            op1 = read();
-            op2 = read();
+            op1 = operand(in.op1, in.kind & IN_PTR1);
+            op2 = operand(in.op2, in.kind & IN_PTR2);
             R = op1 & op2;
             break;
          case OP_AND | STACK:
@@ -354,77 +2682,98 @@ public:
             push(op1 & op2);
             break;
          case OP_HOST:
-            hostCallback();
+            callHost();
+            break;
+         case OP_HOSTN:
+            op1 = operand(in.op1, in.kind & IN_PTR1);
+            if (!hostCall(op1))
+               term = ERR_HOSTCALL;
+            break;
+         case OP_HOSTN | STACK:
+            if (!hostCall(pop()))
+               term = ERR_HOSTCALL;
             break;
          case OP_VPUSH:
-            op1 = read();
-            op2 = read();
-            ++get(op1);
-            get(get(op1)) = op2;
+            op1 = operand(in.op1, in.kind & IN_PTR1);
+            op2 = operand(in.op2, in.kind & IN_PTR2);
+            ++cell(op1);
+            cell(get(op1)) = op2;
             break;
          case OP_VPOP:
-            op1 = read();
-            op2 = read();
-            get(op2) = get(op1);
-            --get(op1);
+            op1 = operand(in.op1, in.kind & IN_PTR1);
+            op2 = operand(in.op2, in.kind & IN_PTR2);
+            cell(op2) = get(op1);
+            --cell(op1);
             break;
-         case OP_CALL:
-            op1 = read(true); // function address
+         case OP_CALL: {
             registers_t regs;
             memcpy(regs.data(), &(io[0]), sizeof(uint64_t) * REG_SIZE);
-            context.push_back(regs); // save all registers, including PC for return
-            PC = op1;
-            break;
+            context.push_back(regs);
+            PC = in.op1;
+            ip = Blocks ? charge(in.target, limit) : in.target;
+            continue;
+         }
          case OP_RET:
-            op1 = read(); // convenience return value
+            op1 = operand(in.op1, in.kind & IN_PTR1);
             if (context.size() == 0) {
                term = ERR_RET;
-               break;
             } else {
                memcpy(&(io[0]), context.back().data(), sizeof(uint64_t) * REG_SIZE);
                context.pop_back();
-               R = op1; // R is assigned the return value instead of restored
-               break;
+               R = op1;
             }
+            break;
          case OP_JF:
-            op1 = read();
+            op1 = operand(in.op1, in.kind & IN_PTR1);
             if (!op1) {
-               PC = read(true);
-               break;
-            } else {
-               PC += 2;
-               break;
+               PC = in.op2;
+               ip = Blocks ? charge(in.target, limit) : in.target;
+               continue;
             }
+            if (Blocks) {
+               ip = charge(locate(PC), limit);
+               continue;
+            }
+            break;
          case OP_JF | STACK:
             op1 = pop();
             if (!op1) {
-               PC = read(true);
-               break;
-            } else {
-               PC += 2;
-               break;
+               PC = in.op1;
+               ip = Blocks ? charge(in.target, limit) : in.target;
+               continue;
+            }
+            if (Blocks) {
+               ip = charge(locate(PC), limit);
+               continue;
             }
+            break;
          case OP_JT:
-            op1 = read();
+            op1 = operand(in.op1, in.kind & IN_PTR1);
             if (op1) {
-               PC = read(true);
-               break;
-            } else {
-               PC += 2;
-               break;
+               PC = in.op2;
+               ip = Blocks ? charge(in.target, limit) : in.target;
+               continue;
             }
+            if (Blocks) {
+               ip = charge(locate(PC), limit);
+               continue;
+            }
+            break;
          case OP_JT | STACK:
             op1 = pop();
             if (op1) {
-               PC = read(true);
-               break;
-            } else {
-               PC += 2;
-               break;
+               PC = in.op1;
+               ip = Blocks ? charge(in.target, limit) : in.target;
+               continue;
+            }
+            if (Blocks) {
+               ip = charge(locate(PC), limit);
+               continue;
             }
+            break;
          case OP_EQ:
-            op1 = read();
-            op2 = read();
+            op1 = operand(in.op1, in.kind & IN_PTR1);
+            op2 = operand(in.op2, in.kind & IN_PTR2);
             R = op1 == op2;
             break;
          case OP_EQ | STACK:
@@ -433,8 +2782,8 @@ public:
             push(op1 == op2);
             break;
          case OP_NE:
-            op1 = read();
-            op2 = read();
+            op1 = operand(in.op1, in.kind & IN_PTR1);
+            op2 = operand(in.op2, in.kind & IN_PTR2);
             R = op1 != op2;
             break;
          case OP_NE | STACK:
@@ -443,8 +2792,8 @@ public:
             push(op1 != op2);
             break;
          case OP_GT:
-            op1 = read();
-            op2 = read();
+            op1 = operand(in.op1, in.kind & IN_PTR1);
+            op2 = operand(in.op2, in.kind & IN_PTR2);
             R = op1 > op2;
             break;
          case OP_GT | STACK:
@@ -453,8 +2802,8 @@ public:
             push(op1 > op2);
             break;
          case OP_LT:
-            op1 = read();
-            op2 = read();
+            op1 = operand(in.op1, in.kind & IN_PTR1);
+            op2 = operand(in.op2, in.kind & IN_PTR2);
             R = op1 < op2;
             break;
          case OP_LT | STACK:
@@ -463,8 +2812,8 @@ public:
             push(op1 < op2);
             break;
          case OP_GE:
-            op1 = read();
-            op2 = read();
+            op1 = operand(in.op1, in.kind & IN_PTR1);
+            op2 = operand(in.op2, in.kind & IN_PTR2);
             R = op1 >= op2;
             break;
          case OP_GE | STACK:
@@ -473,8 +2822,8 @@ public:
             push(op1 >= op2);
             break;
          case OP_LE:
-            op1 = read();
-            op2 = read();
+            op1 = operand(in.op1, in.kind & IN_PTR1);
+            op2 = operand(in.op2, in.kind & IN_PTR2);
             R = op1 <= op2;
             break;
          case OP_LE | STACK:
@@ -483,7 +2832,7 @@ public:
             push(op1 <= op2);
             break;
          case OP_NEG:
-            op1 = read();
+            op1 = operand(in.op1, in.kind & IN_PTR1);
             R = ~op1;
             break;
          case OP_NEG | STACK:
@@ -491,8 +2840,8 @@ public:
             push(~op1);
             break;
          case OP_ORL:
-            op1 = read();
-            op2 = read();
+            op1 = operand(in.op1, in.kind & IN_PTR1);
+            op2 = operand(in.op2, in.kind & IN_PTR2);
             R = op1 || op2;
             break;
          case OP_ORL | STACK:
@@ -500,37 +2849,605 @@ public:
             op1 = pop();
             push(op1 || op2);
             break;
-         default:
-            term = ERR_OPCODE;
+         GVM_PUSHED(OP_ADD, op1 + op2)
+         case OP_SUB | PUSHED:
+            op1 = operand(in.op1, in.kind & IN_PTR1);
+            op2 = operand(in.op2, in.kind & IN_PTR2);
+            push(op1 - op2);
+            if (Checks::negNum && op1 < op2)
+               term = ERR_NEGNUM;
+            break;
+         GVM_PUSHED(OP_MUL, op1 * op2)
+         case OP_DIV | PUSHED:
+            op1 = operand(in.op1, in.kind & IN_PTR1);
+            op2 = operand(in.op2, in.kind & IN_PTR2);
+            if (op2 != 0)
+               push(op1 / op2);
+            else
+               term = ERR_DIVZERO;
+            break;
+         case OP_MOD | PUSHED:
+            op1 = operand(in.op1, in.kind & IN_PTR1);
+            op2 = operand(in.op2, in.kind & IN_PTR2);
+            if (op2 != 0)
+               push(op1 % op2);
+            else
+               term = ERR_DIVZERO;
+            break;
+         GVM_PUSHED(OP_OR, op1 | op2)
+         GVM_PUSHED(OP_XOR, op1 ^ op2)
+         GVM_PUSHED(OP_SHL, op1 << op2)
+         GVM_PUSHED(OP_SHR, op1 >> op2)
+         GVM_PUSHED(OP_AND, op1 & op2)
+         GVM_PUSHED(OP_EQ, op1 == op2)
+         GVM_PUSHED(OP_NE, op1 != op2)
+         GVM_PUSHED(OP_GT, op1 > op2)
+         GVM_PUSHED(OP_LT, op1 < op2)
+         GVM_PUSHED(OP_GE, op1 >= op2)
+         GVM_PUSHED(OP_LE, op1 <= op2)
+         GVM_PUSHED(OP_ORL, op1 || op2)
+         GVM_JF(OP_JFEQ, ==)
+         GVM_JF(OP_JFNE, !=)
+         GVM_JF(OP_JFGT, >)
+         GVM_JF(OP_JFLT, <)
+         GVM_JF(OP_JFGE, >=)
+         GVM_JF(OP_JFLE, <=)
+         GVM_INCJ(OP_INCJEQ, ==)
+         GVM_INCJ(OP_INCJNE, !=)
+         GVM_INCJ(OP_INCJGT, >)
+         GVM_INCJ(OP_INCJLT, <)
+         GVM_INCJ(OP_INCJGE, >=)
+         GVM_INCJ(OP_INCJLE, <=)
+         }
+         // fall through to the next record unless the instruction moved PC
+         if (PC == in.next && (!Blocks || !term)) {
+            ++ip;
+         } else if (Blocks) {
+            // left the run early: refund the instructions that didn't execute
+            count -= decodedCost[ip] - 1;
+            ip = charge(locate(PC), limit);
+         } else {
+            ip = locate(PC);
          }
       }
    }
 
-private:
+#undef GVM_PUSHED
+#undef GVM_BRANCH
+#undef GVM_JF
+#undef GVM_INCJ
+
+   // Blocks: pays for the instructions from 'ip' to the end of its run
+   uint32_t charge(uint32_t ip, uint64_t limit) {
+      if (!term && ip != DECODED_NONE && decodedCost[ip] <= limit - count) {
+         count += decodedCost[ip];
+         return ip;
+      }
+      return chargeSlow(ip, limit);
+   }
+
+   // the rest of the run at 'ip' doesn't fit in the limit, or 'ip' is not an
+   // instruction boundary: LIMIT_BLOCK stops here, otherwise instructions are
+   // executed and counted one at a time until the rest of a run fits again
+   uint32_t chargeSlow(uint32_t ip, uint64_t limit) {
+      while (!term && PC < code.size()) {
+         if (ip != DECODED_NONE) {
+            if (decodedCost[ip] <= limit - count) {
+               count += decodedCost[ip];
+               return ip;
+            }
+            if (limitMode == LIMIT_BLOCK) {
+               ++count;
+               term = ERR_OPLIMIT;
+               break;
+            }
+         }
+         if (overLimit(limit)) {
+            term = ERR_OPLIMIT;
+            break;
+         }
+         step();
+         ip = locate(PC);
+      }
+      return DECODED_NONE;
+   }
+
+   // shape of @addr as an operand, Q_NONE if it is PC or out of range
+   static uint8_t quickShape(uint64_t addr) {
+      if (addr == 1)
+         return Q_R;
+      if (addr == 2)
+         return Q_S;
+      if (addr >= 3 && addr < IO_SIZE)
+         return Q_IO;
+      return Q_NONE;
+   }
+
+   // fills in quick[pc] for the instruction at 'pc', which runs for the first
+   // time; anything the quick engine doesn't specialize is left to step()
+   void quicken(uint64_t pc) {
+      Quick& q = quick[pc];
+      q.key = QUICK_STEP;
+      uint8_t op = code[pc];
+      OpLayout layout = opLayout(op);
+      if (!layout.valid || op == OP_VPUSH || op == OP_VPOP)
+         return;
+      uint64_t npc = pc + 1;
+      uint64_t val[2] = { 0, 0 };
+      uint8_t shape[2] = { Q_IMM, Q_IMM };
+      // the first operand of these is the address of the cell they write
+      bool dest = op == OP_SET || op == OP_INC || op == OP_DEC || op == OP_POP ||
+                  (op >= OP_INCJEQ && op <= OP_INCJLE);
+      for (int i = 0; i < layout.operands; ++i) {
+         bool ptr;
+         if (!decodeOperand(npc, val[i], ptr))
+            return;
+         if (i == 0 && dest)
+            shape[i] = ptr ? uint8_t(Q_NONE) : quickShape(val[i]);
+         else if (ptr)
+            shape[i] = quickShape(val[i]);
+         if (shape[i] == Q_NONE)
+            return;
+      }
+      if (layout.target) {
+         if (npc + 2 > code.size())
+            return;
+         memcpy(&q.addr, &code[npc], 2); // Little-endian
+         npc += 2;
+      }
+      q.key = quickKey(op, shape[0], shape[1]);
+      q.next = npc;
+      q.a = val[0];
+      q.b = val[1];
+   }
+
+   template <uint8_t Shape>
+   GVM_INLINE uint64_t& quickCell(uint64_t addr, Regs& regs) {
+      return Shape == Q_R ? regs.r : Shape == Q_S ? regs.s : io[addr];
+   }
+
+   // quickCell() for a destination operand
+   template <uint8_t Shape>
+   GVM_INLINE uint64_t& quickDest(uint64_t addr, Regs& regs) {
+      if (Shape == Q_IO)
+         dirty[addr / IO_LINE] = true;
+      return quickCell<Shape>(addr, regs);
+   }
+
+   template <uint8_t Shape>
+   GVM_INLINE uint64_t quickValue(uint64_t value, Regs& regs) {
+      return Shape == Q_IMM ? value : quickCell<Shape>(value, regs);
+   }
+
+   // a handler for every shape of the operands: op1 and op2 hold their values,
+   // 'cell' is the io cell that a destination operand names
+#define GVM_Q1(op, s1, ...)                     \
+   case quickKey(op, s1):                       \
+      op1 = quickValue<s1>(q.a, regs);          \
+      __VA_ARGS__                               \
+      break;
+
+#define GVM_Q1ALL(op, ...)                      \
+   GVM_Q1(op, Q_IMM, __VA_ARGS__)               \
+   GVM_Q1(op, Q_IO, __VA_ARGS__)                \
+   GVM_Q1(op, Q_R, __VA_ARGS__)                 \
+   GVM_Q1(op, Q_S, __VA_ARGS__)
+
+#define GVM_Q2(op, s1, s2, ...)                 \
+   case quickKey(op, s1, s2):                   \
+      op1 = quickValue<s1>(q.a, regs);          \
+      op2 = quickValue<s2>(q.b, regs);          \
+      __VA_ARGS__                               \
+      break;
+
+#define GVM_Q2X(op, s1, ...)                    \
+   GVM_Q2(op, s1, Q_IMM, __VA_ARGS__)           \
+   GVM_Q2(op, s1, Q_IO, __VA_ARGS__)            \
+   GVM_Q2(op, s1, Q_R, __VA_ARGS__)             \
+   GVM_Q2(op, s1, Q_S, __VA_ARGS__)
+
+#define GVM_Q2ALL(op, ...)                      \
+   GVM_Q2X(op, Q_IMM, __VA_ARGS__)              \
+   GVM_Q2X(op, Q_IO, __VA_ARGS__)               \
+   GVM_Q2X(op, Q_R, __VA_ARGS__)                \
+   GVM_Q2X(op, Q_S, __VA_ARGS__)
+
+#define GVM_QD(op, d, ...)                      \
+   case quickKey(op, d): {                      \
+      uint64_t& cell = quickDest<d>(q.a, regs); \
+      __VA_ARGS__                               \
+      break;                                    \
+   }
+
+#define GVM_QDALL(op, ...)                      \
+   GVM_QD(op, Q_IO, __VA_ARGS__)                \
+   GVM_QD(op, Q_R, __VA_ARGS__)                 \
+   GVM_QD(op, Q_S, __VA_ARGS__)
+
+   // a destination and a value; the value is read after 'pre' ran
+#define GVM_QDV(op, d, s2, pre, ...)            \
+   case quickKey(op, d, s2): {                  \
+      uint64_t& cell = quickDest<d>(q.a, regs); \
+      pre                                       \
+      op2 = quickValue<s2>(q.b, regs);          \
+      __VA_ARGS__                               \
+      break;                                    \
+   }
+
+#define GVM_QDVX(op, d, pre, ...)               \
+   GVM_QDV(op, d, Q_IMM, pre, __VA_ARGS__)      \
+   GVM_QDV(op, d, Q_IO, pre, __VA_ARGS__)       \
+   GVM_QDV(op, d, Q_R, pre, __VA_ARGS__)        \
+   GVM_QDV(op, d, Q_S, pre, __VA_ARGS__)
+
+#define GVM_QDVALL(op, pre, ...)                \
+   GVM_QDVX(op, Q_IO, pre, __VA_ARGS__)         \
+   GVM_QDVX(op, Q_R, pre, __VA_ARGS__)          \
+   GVM_QDVX(op, Q_S, pre, __VA_ARGS__)
+
+#define GVM_QHOSTN()                            \
+      storeRegs(regs);                          \
+      if (!hostCall(op1))                       \
+         term = ERR_HOSTCALL;                   \
+      loadRegs(regs);                           \
+      if (quick.size() != code.size())          \
+         quick.assign(code.size(), Quick { QUICK_NONE, 0, 0, 0, 0 });
+
+#define GVM_QSTACK(op, ...)                     \
+   case quickKey(op):                           \
+      op2 = pop(regs);                          \
+      op1 = pop(regs);                          \
+      __VA_ARGS__                               \
+      break;
+
+   // ENGINE_QUICK: the interpreter, except that the instruction at each
+   // address is decoded once, into quick[], the first time it runs. From
+   // then on a handler made for the shapes of its operands (ADD with an
+   // immediate and an io cell, SET of an io cell to R...) reads them from
+   // the record, with no control bytes to parse and no address checks. The
+   // record is per address, so jumping into the middle of an instruction
+   // works as it does in the interpreter. Instructions that can't be
+   // specialized (VPUSH, VPOP, computed destinations, out-of-range or @0
+   // destinations, invalid code) run through step().
+   void runQuick(uint64_t limit) {
+      if (quick.size() != code.size())
+         quick.assign(code.size(), Quick { QUICK_NONE, 0, 0, 0, 0 });
+      uint64_t op1, op2;
+      Regs regs;
+      loadRegs(regs);
+      while (!term && regs.pc < code.size()) {
+         if (overLimit(limit)) {
+            term = ERR_OPLIMIT;
+            break;
+         }
+         uint64_t pc = regs.pc;
+         Quick& q = quick[pc];
+         if (q.key == QUICK_NONE)
+            quicken(pc);
+         opcode = code[pc];
+         regs.pc = q.next;
+         switch (q.key) {
+         case quickKey(OP_NOP):
+            break;
+         case quickKey(OP_TERM):
+            regs.pc = UINT64_MAX;
+            break;
+         case quickKey(OP_JMP):
+            regs.pc = q.addr;
+            break;
+         GVM_QDVALL(OP_SET, , cell = op2;)
+         GVM_Q2ALL(OP_ADD, regs.r = op1 + op2;)
+         GVM_Q2ALL(OP_SUB, regs.r = op1 - op2; if (Checks::negNum && op1 < op2) term = ERR_NEGNUM;)
+         GVM_Q2ALL(OP_MUL, regs.r = op1 * op2;)
+         GVM_Q2ALL(OP_DIV, if (op2 != 0) regs.r = op1 / op2; else term = ERR_DIVZERO;)
+         GVM_Q2ALL(OP_MOD, if (op2 != 0) regs.r = op1 % op2; else term = ERR_DIVZERO;)
+         GVM_Q2ALL(OP_OR, regs.r = op1 | op2;)
+         GVM_Q2ALL(OP_ANDL, regs.r = op1 && op2;)
+         GVM_Q2ALL(OP_XOR, regs.r = op1 ^ op2;)
+         GVM_Q1ALL(OP_NOT, regs.r = !op1;)
+         GVM_Q2ALL(OP_SHL, regs.r = op1 << op2;)
+         GVM_Q2ALL(OP_SHR, regs.r = op1 >> op2;)
+         GVM_QDALL(OP_INC, ++cell;)
+         GVM_QDALL(OP_DEC, --cell;)
+         GVM_Q1ALL(OP_PUSH, push(op1, regs);)
+         GVM_QDALL(OP_POP, cell = pop(regs);)
+         GVM_Q2ALL(OP_AND, regs.r = op1 & op2;)
+         GVM_Q2ALL(OP_EQ, regs.r = op1 == op2;)
+         GVM_Q2ALL(OP_NE, regs.r = op1 != op2;)
+         GVM_Q2ALL(OP_GT, regs.r = op1 > op2;)
+         GVM_Q2ALL(OP_LT, regs.r = op1 < op2;)
+         GVM_Q2ALL(OP_GE, regs.r = op1 >= op2;)
+         GVM_Q2ALL(OP_LE, regs.r = op1 <= op2;)
+         GVM_Q1ALL(OP_NEG, regs.r = ~op1;)
+         GVM_Q2ALL(OP_ORL, regs.r = op1 || op2;)
+         GVM_QSTACK(OP_ADD | STACK, push(op1 + op2, regs);)
+         GVM_QSTACK(OP_SUB | STACK, push(op1 - op2, regs); if (Checks::negNum && op1 < op2) term = ERR_NEGNUM;)
+         GVM_QSTACK(OP_MUL | STACK, push(op1 * op2, regs);)
+         GVM_QSTACK(OP_DIV | STACK, if (op2 != 0) push(op1 / op2, regs); else term = ERR_DIVZERO;)
+         GVM_QSTACK(OP_MOD | STACK, if (op2 != 0) push(op1 % op2, regs); else term = ERR_DIVZERO;)
+         GVM_QSTACK(OP_OR | STACK, push(op1 | op2, regs);)
+         GVM_QSTACK(OP_ANDL | STACK, regs.r = op1 && op2;)
+         GVM_QSTACK(OP_XOR | STACK, push(op1 ^ op2, regs);)
+         GVM_QSTACK(OP_SHL | STACK, push(op1 << op2, regs);)
+         GVM_QSTACK(OP_SHR | STACK, push(op1 >> op2, regs);)
+         GVM_QSTACK(OP_AND | STACK, push(op1 & op2, regs);)
+         GVM_QSTACK(OP_EQ | STACK, push(op1 == op2, regs);)
+         GVM_QSTACK(OP_NE | STACK, push(op1 != op2, regs);)
+         GVM_QSTACK(OP_GT | STACK, push(op1 > op2, regs);)
+         GVM_QSTACK(OP_LT | STACK, push(op1 < op2, regs);)
+         GVM_QSTACK(OP_GE | STACK, push(op1 >= op2, regs);)
+         GVM_QSTACK(OP_LE | STACK, push(op1 <= op2, regs);)
+         GVM_QSTACK(OP_ORL | STACK, push(op1 || op2, regs);)
+         case quickKey(OP_NOT | STACK):
+            push(!pop(regs), regs);
+            break;
+         case quickKey(OP_NEG | STACK):
+            push(~pop(regs), regs);
+            break;
+         case quickKey(OP_HOST):
+            storeRegs(regs);
+            callHost();
+            loadRegs(regs);
+            if (quick.size() != code.size()) // the host called setCode()
+               quick.assign(code.size(), Quick { QUICK_NONE, 0, 0, 0, 0 });
+            break;
+         GVM_Q1ALL(OP_HOSTN, GVM_QHOSTN();)
+         case quickKey(OP_HOSTN | STACK):
+            op1 = pop(regs);
+            GVM_QHOSTN();
+            break;
+         case quickKey(OP_CALL): {
+            registers_t saved;
+            storeRegs(regs);
+            memcpy(saved.data(), &(io[0]), sizeof(uint64_t) * REG_SIZE);
+            context.push_back(saved); // save all registers, including PC for return
+            regs.pc = q.addr;
+            break;
+         }
+         GVM_Q1ALL(OP_RET,
+            if (context.size() == 0) {
+               term = ERR_RET;
+            } else {
+               storeRegs(regs); // for the stack
+               memcpy(&(io[0]), context.back().data(), sizeof(uint64_t) * REG_SIZE);
+               context.pop_back();
+               loadRegs(regs);
+               regs.r = op1; // R is assigned the return value instead of restored
+            })
+         GVM_Q1ALL(OP_JF, if (!op1) regs.pc = q.addr;)
+         GVM_Q1ALL(OP_JT, if (op1) regs.pc = q.addr;)
+         case quickKey(OP_JF | STACK):
+            if (!pop(regs))
+               regs.pc = q.addr;
+            break;
+         case quickKey(OP_JT | STACK):
+            if (pop(regs))
+               regs.pc = q.addr;
+            break;
+         GVM_Q2ALL(OP_ADD | PUSHED, push(op1 + op2, regs);)
+         GVM_Q2ALL(OP_SUB | PUSHED, push(op1 - op2, regs); if (Checks::negNum && op1 < op2) term = ERR_NEGNUM;)
+         GVM_Q2ALL(OP_MUL | PUSHED, push(op1 * op2, regs);)
+         GVM_Q2ALL(OP_DIV | PUSHED, if (op2 != 0) push(op1 / op2, regs); else term = ERR_DIVZERO;)
+         GVM_Q2ALL(OP_MOD | PUSHED, if (op2 != 0) push(op1 % op2, regs); else term = ERR_DIVZERO;)
+         GVM_Q2ALL(OP_OR | PUSHED, push(op1 | op2, regs);)
+         GVM_Q2ALL(OP_XOR | PUSHED, push(op1 ^ op2, regs);)
+         GVM_Q2ALL(OP_SHL | PUSHED, push(op1 << op2, regs);)
+         GVM_Q2ALL(OP_SHR | PUSHED, push(op1 >> op2, regs);)
+         GVM_Q2ALL(OP_AND | PUSHED, push(op1 & op2, regs);)
+         GVM_Q2ALL(OP_EQ | PUSHED, push(op1 == op2, regs);)
+         GVM_Q2ALL(OP_NE | PUSHED, push(op1 != op2, regs);)
+         GVM_Q2ALL(OP_GT | PUSHED, push(op1 > op2, regs);)
+         GVM_Q2ALL(OP_LT | PUSHED, push(op1 < op2, regs);)
+         GVM_Q2ALL(OP_GE | PUSHED, push(op1 >= op2, regs);)
+         GVM_Q2ALL(OP_LE | PUSHED, push(op1 <= op2, regs);)
+         GVM_Q2ALL(OP_ORL | PUSHED, push(op1 || op2, regs);)
+         GVM_Q2ALL(OP_JFEQ, if (!(op1 == op2)) regs.pc = q.addr;)
+         GVM_Q2ALL(OP_JFNE, if (!(op1 != op2)) regs.pc = q.addr;)
+         GVM_Q2ALL(OP_JFGT, if (!(op1 > op2)) regs.pc = q.addr;)
+         GVM_Q2ALL(OP_JFLT, if (!(op1 < op2)) regs.pc = q.addr;)
+         GVM_Q2ALL(OP_JFGE, if (!(op1 >= op2)) regs.pc = q.addr;)
+         GVM_Q2ALL(OP_JFLE, if (!(op1 <= op2)) regs.pc = q.addr;)
+         GVM_QSTACK(OP_JFEQ | STACK, if (!(op1 == op2)) regs.pc = q.addr;)
+         GVM_QSTACK(OP_JFNE | STACK, if (!(op1 != op2)) regs.pc = q.addr;)
+         GVM_QSTACK(OP_JFGT | STACK, if (!(op1 > op2)) regs.pc = q.addr;)
+         GVM_QSTACK(OP_JFLT | STACK, if (!(op1 < op2)) regs.pc = q.addr;)
+         GVM_QSTACK(OP_JFGE | STACK, if (!(op1 >= op2)) regs.pc = q.addr;)
+         GVM_QSTACK(OP_JFLE | STACK, if (!(op1 <= op2)) regs.pc = q.addr;)
+         GVM_QDVALL(OP_INCJEQ, ++cell;, regs.r = cell == op2; if (regs.r) regs.pc = q.addr;)
+         GVM_QDVALL(OP_INCJNE, ++cell;, regs.r = cell != op2; if (regs.r) regs.pc = q.addr;)
+         GVM_QDVALL(OP_INCJGT, ++cell;, regs.r = cell > op2; if (regs.r) regs.pc = q.addr;)
+         GVM_QDVALL(OP_INCJLT, ++cell;, regs.r = cell < op2; if (regs.r) regs.pc = q.addr;)
+         GVM_QDVALL(OP_INCJGE, ++cell;, regs.r = cell >= op2; if (regs.r) regs.pc = q.addr;)
+         GVM_QDVALL(OP_INCJLE, ++cell;, regs.r = cell <= op2; if (regs.r) regs.pc = q.addr;)
+         default: // QUICK_STEP
+            regs.pc = pc;
+            storeRegs(regs);
+            step();
+            loadRegs(regs);
+         }
+      }
+      storeRegs(regs);
+   }
+
+#undef GVM_Q1
+#undef GVM_Q1ALL
+#undef GVM_Q2
+#undef GVM_Q2X
+#undef GVM_Q2ALL
+#undef GVM_QD
+#undef GVM_QDALL
+#undef GVM_QDV
+#undef GVM_QDVX
+#undef GVM_QDVALL
+#undef GVM_QSTACK
+#undef GVM_QHOSTN
+
+   // decodes the operand at 'pc' the way read() does, without touching the VM state
+   bool decodeOperand(uint64_t& pc, uint64_t& val, bool& regptr) {
+      if (pc >= code.size())
+         return false;
+      uint8_t control = code[pc++];
+      uint8_t v = control & MAX_SHORT_VAL;
+      regptr = control & REG_PTR;
+      if (control & SHORT_VAL) {
+         val = v;
+      } else {
+         val = 0;
+         if (v > sizeof(val) || pc + v > code.size())
+            return false;
+         memcpy(&val, &code[pc], v); // Little-endian
+         pc += v;
+      }
+      if (regptr && val == 0) {
+         // @0 reads PC, which is known here: the address right after the operand
+         val = pc;
+         regptr = false;
+      }
+      return true;
+   }
+
+   // an address as the io index it accesses: wrapped or truncated, for
+   // IO_MASKED and IO_GUARDED
+   static GVM_INLINE uint64_t address(uint64_t index) {
+      return Checks::addressing == IO_MASKED ? index & (IO_SIZE - 1) :
+             Checks::addressing == IO_GUARDED ? uint32_t(index) : index;
+   }
+
+   // io access from the interpreter: PC, R and S are in 'regs'
+   GVM_INLINE uint64_t get(uint64_t index, const Regs& regs) {
+      index = address(index);
+      if (Checks::addressing == IO_CHECKED ? index - 3 < IO_SIZE - 3 : index >= 3) // 3 <= index < IO_SIZE
+         return io[index];
+      switch (index) {
+      case 0:
+         return regs.pc;
+      case 1:
+         return regs.r;
+      case 2:
+         return regs.s;
+      default:
+         if (memory)
+            return memory->read(index);
+         term = ERR_SEGFAULT;
+         return regs.r; // whatever; program is dead
+      }
+   }
+
+   // with IO_GUARDED, reads io[index] so that an address beyond io faults
+   // here, before the caller marks a line outside 'dirty'; the fence keeps the
+   // compiler from moving that store in front of the read
+   GVM_INLINE void probe(uint64_t index) {
+      (void)*static_cast<volatile uint64_t*>(&io[index]);
+      std::atomic_signal_fence(std::memory_order_seq_cst);
+   }
+
+   GVM_INLINE void put(uint64_t index, uint64_t value, Regs& regs) {
+      index = address(index);
+      if (Checks::addressing == IO_CHECKED ? index - 3 < IO_SIZE - 3 : index >= 3) {
+         if (Checks::addressing == IO_GUARDED)
+            probe(index);
+         io[index] = value;
+         dirty[index / IO_LINE] = true;
+         return;
+      }
+      switch (index) {
+      case 0:
+         regs.pc = value;
+         break;
+      case 1:
+         regs.r = value;
+         break;
+      case 2:
+         regs.s = value;
+         break;
+      default:
+         if (memory) {
+            uint64_t* cell = memory->cell(index);
+            if (cell) {
+               *cell = value;
+               break;
+            }
+            term = ERR_MEMORY;
+            break;
+         }
+         term = ERR_SEGFAULT;
+         regs.r = value; // whatever; program is dead
+      }
+   }
 
+   // a cell to read (a GMemory cell is read into 'loaded')
    uint64_t& get(uint64_t index) {
-      if (index < IO_SIZE) {
+      index = address(index);
+      if (Checks::addressing != IO_CHECKED || index < IO_SIZE) {
          return io[index];
+      } else if (memory) {
+         loaded = memory->read(index);
+         return loaded;
       } else {
          term = ERR_SEGFAULT;
          return R; // whatever; program is dead
       }
    }
 
-   void push(uint64_t v) { stack.push_back(v); }
+   // a cell that is about to be written
+   uint64_t& cell(uint64_t index) {
+      index = address(index);
+      if (Checks::addressing == IO_GUARDED)
+         probe(index);
+      if (Checks::addressing != IO_CHECKED || index < IO_SIZE) {
+         dirty[index / IO_LINE] = true;
+         return io[index];
+      }
+      if (memory) {
+         uint64_t* cell = memory->cell(index);
+         if (cell)
+            return *cell;
+         term = ERR_MEMORY;
+      } else {
+         term = ERR_SEGFAULT;
+      }
+      return R; // whatever; program is dead
+   }
+
+   uint64_t loaded; // see get()
+
+   void push(uint64_t v) {
+      if (!stack.push_back(v))
+         term = ERR_OVERFLOW;
+   }
 
    uint64_t pop() {
-      if (stack.size() == 0) {
+      if (stack.n == 0) {
+         term = ERR_UNDERFLOW;
+         return 0; // whatever; program is dead
+      }
+      return stack.slot[stack.n--];
+   }
+
+   // stack access from the interpreter, through the cached top of stack
+   GVM_INLINE void push(uint64_t v, Regs& regs) {
+      if (regs.sp == STACK_SIZE) {
+         term = ERR_OVERFLOW;
+         return;
+      }
+      stack.slot[regs.sp++] = regs.tos;
+      regs.tos = v;
+   }
+
+   template <bool Unchecked = false>
+   GVM_INLINE uint64_t pop(Regs& regs) {
+      if (!Unchecked && regs.sp == 0) {
          term = ERR_UNDERFLOW;
          return 0; // whatever; program is dead
       }
-      uint64_t operand = stack.back();
-      stack.pop_back();
+      uint64_t operand = regs.tos;
+      regs.tos = stack.slot[--regs.sp];
       return operand;
    }
 
-   uint64_t read(bool jump_skip_control = false) {
-      if (PC >= code.size()) {
+   template <bool Unchecked = false, class Hooks = GVMNoHooks>
+   GVM_INLINE uint64_t read(Regs& regs, bool jump_skip_control = false) {
+      if (!Unchecked && regs.pc >= code.size()) {
          term = ERR_CODESIZE;
          return 0;
       }
@@ -538,7 +3455,7 @@ private:
       if (jump_skip_control)
          control = 2;
       else
-         control = code[PC++];
+         control = code[regs.pc++];
       uint8_t v = control & MAX_SHORT_VAL;
       bool regptr = control & REG_PTR;
       bool shortval = control & SHORT_VAL;
@@ -547,15 +3464,32 @@ private:
          val = v;
       } else {
          val = 0;
-         if (PC + v > code.size()) {
+         if (!Unchecked && (v > sizeof(val) || regs.pc + v > code.size())) {
             term = ERR_CODESIZE;
             return 0;
          }
-         memcpy(&val, &code[PC], v); // Little-endian
-         PC += v;
+         memcpy(&val, &code[regs.pc], v); // Little-endian
+         regs.pc += v;
+      }
+      if (regptr) {
+         uint64_t addr = val;
+         if (!Unchecked)
+            val = get(addr, regs);
+         else if (addr >= 3)
+            val = io[addr];
+         else
+            val = addr == 1 ? regs.r : addr == 2 ? regs.s : regs.pc;
+         Hooks::read(*this, addr, val);
       }
-      if (regptr)
-         val = get(val);
       return val;
    }
 };
+
+typedef BasicGVM<> GVM;
+
+// for very many instances: 64 cells of io (512 bytes, outside the VM) and a
+// stack of 64 values
+typedef BasicGVM<64, 4, GVMChecks, 64> GVMTiny;
+static_assert(sizeof(GVMTiny) <= 2048, "a GVMTiny should stay small (the default GVM is over 8 Kb)");
+
+#endif
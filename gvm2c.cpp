@@ -0,0 +1,342 @@
+/*
+  GVM2C
+
+  Ahead-of-time compiler from GVM bytecode to C.
+
+  This takes an input GASM bytecode file and writes a C source file (to stdout,
+  or to the optional second parameter) that runs that program. Compile it to a
+  shared object and hand it to GVM::loadNative() (gvm --native <file.so>):
+
+    gvm2c prog.b prog.c
+    cc -O2 -shared -fPIC prog.c -o prog.so
+    gvm prog.b --native prog.so
+
+  The program becomes a single function with a label per jump target (and per
+  return address), so jumps are plain gotos. R and S are kept in locals, io
+  addresses are checked inline, and the op count is checked before every
+  instruction exactly as the interpreter does.
+
+  Instructions that need the VM's own state (stack, call stack, host callback)
+  or that could write PC, plus anything that fails a bounds check at run time,
+  are executed by calling back into GVM::step(). A PC that isn't known at
+  compile time (RET, a computed write to io[0]...) goes through a switch over
+  the labels; addresses without a label are stepped one at a time.
+*/
+
+#include "gvm.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <set>
+#include <string>
+
+class GCompiler {
+public:
+   const GProgram& program;
+   GView<uint8_t> code;
+   std::ostream& out;
+
+   GCompiler(const GProgram& program, std::ostream& out) : program(program), code(program.bytes()), out(out) {}
+
+   void compile(const std::string& source) {
+      GVM::memory_t io;
+      GVM vm(io, program);
+      vm.decode();
+      GView<GVM::Instr> decoded = vm.decoded;
+
+      // labels: jump targets, return addresses and the entry point
+      std::set<uint64_t> labels;
+      if (!decoded.empty())
+         labels.insert(0);
+      for (const GVM::Instr& in : decoded) {
+         if (in.opcode == GVM::OP_SLOW || !opLayout(in.opcode).target)
+            continue;
+         if (in.target != GVM::DECODED_NONE)
+            labels.insert(in.addr);
+         if (in.opcode == OP_CALL && in.next < code.size())
+            labels.insert(in.next);
+      }
+
+      prologue(source);
+      for (const GVM::Instr& in : decoded) {
+         if (labels.count(in.pc))
+            out << "L" << in.pc << ":\n";
+         instruction(in, labels);
+      }
+      if (!decoded.empty())
+         out << "   io[0] = " << decoded.back().next << "ULL;\n   goto out;\n";
+
+      // dispatch on a PC that is only known at run time
+      out << "dispatch:\n";
+      out << "   if (ctx->term || io[0] >= GVM_CODE_SIZE)\n      goto out;\n";
+      out << "   switch (io[0]) {\n";
+      for (uint64_t label : labels)
+         out << "   case " << label << ": goto L" << label << ";\n";
+      out << "   }\n";
+      out << "   LIMIT(io[0]);\n";
+      out << "   STEP(io[0]);\n";
+      out << "   goto dispatch;\n";
+      out << "out:\n";
+      out << "   io[1] = R;\n   io[2] = S;\n";
+      out << "   ctx->count = count;\n   ctx->opcode = opcode;\n";
+      out << "}\n";
+   }
+
+private:
+
+   void prologue(const std::string& source) {
+      out << "/* generated by gvm2c from " << source << "; do not edit */\n\n";
+      out << "#include <stdint.h>\n\n";
+      out << "typedef struct GVMNativeContext {\n"
+          << "   uint64_t* io;\n"
+          << "   uint64_t  count;\n"
+          << "   uint64_t  limit;\n"
+          << "   uint64_t  term;\n"
+          << "   uint64_t  opcode;\n"
+          << "   void*     vm;\n"
+          << "   void    (*step)(struct GVMNativeContext*);\n"
+          << "} GVMNativeContext;\n\n";
+      out << "#define GVM_IO_SIZE   " << IO_SIZE << "ULL\n";
+      out << "#define GVM_CODE_SIZE " << code.size() << "ULL\n\n";
+      out << "const uint64_t gvm_native_abi       = " << NATIVE_ABI << "ULL;\n";
+      out << "const uint64_t gvm_native_io_size   = GVM_IO_SIZE;\n";
+      out << "const uint64_t gvm_native_code_size = GVM_CODE_SIZE;\n";
+      out << "const uint64_t gvm_native_hash      = " << codeHash(code) << "ULL;\n\n";
+      // op limit, checked before each instruction like GVM::run
+      out << "#define LIMIT(pc) \\\n"
+          << "   if (count >= ctx->limit) { ++count; io[0] = (pc); ctx->term = " << ERR_OPLIMIT << "; goto out; } \\\n"
+          << "   ++count\n";
+      // an error detected after the instruction's operands were read
+      out << "#define FAIL(next, err) \\\n"
+          << "   { io[0] = (next); ctx->term = (err); goto out; }\n";
+      // runs the instruction at 'pc' in the VM; R and S are spilled around it
+      out << "#define STEP(pc) \\\n"
+          << "   io[0] = (pc); io[1] = R; io[2] = S; \\\n"
+          << "   ctx->step(ctx); \\\n"
+          << "   R = io[1]; S = io[2]; opcode = ctx->opcode; \\\n"
+          << "   if (ctx->term) goto out\n";
+      // STEP, continuing at 'next' unless the instruction moved PC
+      out << "#define STEP_NEXT(pc, next) \\\n"
+          << "   STEP(pc); \\\n"
+          << "   if (io[0] != (next)) goto dispatch\n\n";
+      out << "void gvm_native_run(GVMNativeContext* ctx) {\n";
+      out << "   uint64_t* io = ctx->io;\n";
+      out << "   uint64_t R = io[1], S = io[2];\n";
+      out << "   uint64_t count = ctx->count;\n";
+      out << "   uint64_t opcode = ctx->opcode;\n";
+      out << "   uint64_t a, b;\n";
+      out << "   (void)a; (void)b;\n";
+      out << "   goto dispatch;\n";
+   }
+
+   // an operand the generated code can read directly
+   static bool direct(uint64_t value, bool ptr) { return !ptr || value < IO_SIZE; }
+
+   // a constant io address the generated code can write directly
+   static bool writable(uint64_t addr) { return addr > 0 && addr < IO_SIZE; }
+
+   static std::string value(uint64_t value, bool ptr) {
+      if (!ptr)
+         return std::to_string(value) + "ULL";
+      if (value == 1)
+         return "R";
+      if (value == 2)
+         return "S";
+      return "io[" + std::to_string(value) + "]";
+   }
+
+   static std::string cell(uint64_t addr) { return value(addr, true); }
+
+   // C operator of the comparison EQ, NE, GT, LT, GE or LE, given as an
+   // offset from the first one (the superinstructions follow the same order)
+   static const char* compare(int cmp) {
+      static const char* const ops[] = { "==", "!=", ">", "<", ">=", "<=" };
+      return ops[cmp];
+   }
+
+   // code that continues at 'addr': a goto if it has a label, else a dispatch
+   static std::string jump(uint64_t addr, const std::set<uint64_t>& labels) {
+      if (labels.count(addr))
+         return "goto L" + std::to_string(addr) + ";";
+      return "{ io[0] = " + std::to_string(addr) + "ULL; goto dispatch; }";
+   }
+
+   void step(const GVM::Instr& in) {
+      out << "   STEP_NEXT(" << in.pc << "ULL, " << in.next << "ULL);\n";
+   }
+
+   // stores 'expr' into the io cell addressed by the destination operand
+   void store(const GVM::Instr& in, const std::string& expr) {
+      bool p1 = in.kind & GVM::IN_PTR1;
+      if (!p1) {
+         out << "   " << cell(in.op1) << " = " << expr << ";\n";
+      } else {
+         // computed address: R, S and PC are only written through step()
+         out << "   a = " << value(in.op1, true) << ";\n";
+         out << "   if (a - 3 < GVM_IO_SIZE - 3) { io[a] = " << expr << "; } else { STEP_NEXT("
+             << in.pc << "ULL, " << in.next << "ULL); }\n";
+      }
+   }
+
+   void instruction(const GVM::Instr& in, const std::set<uint64_t>& labels) {
+      bool p1 = in.kind & GVM::IN_PTR1;
+      bool p2 = in.kind & GVM::IN_PTR2;
+      uint8_t op = in.opcode;
+      out << "   LIMIT(" << in.pc << "ULL);\n";
+      switch (op) {
+      case OP_NOP:
+         out << "   opcode = " << int(op) << ";\n";
+         return;
+      case OP_TERM:
+         out << "   opcode = " << int(op) << ";\n";
+         out << "   io[0] = UINT64_MAX;\n   goto out;\n";
+         return;
+      case OP_JMP:
+         out << "   opcode = " << int(op) << ";\n";
+         out << "   " << jump(in.op1, labels) << "\n";
+         return;
+      case OP_SET:
+         if (!direct(in.op2, p2) || !direct(in.op1, p1) || (!p1 && !writable(in.op1)))
+            break;
+         out << "   opcode = " << int(op) << ";\n";
+         store(in, value(in.op2, p2));
+         return;
+      case OP_INC:
+      case OP_DEC:
+         if (!direct(in.op1, p1) || (!p1 && !writable(in.op1)))
+            break;
+         out << "   opcode = " << int(op) << ";\n";
+         if (!p1) {
+            out << "   " << (op == OP_INC ? "++" : "--") << cell(in.op1) << ";\n";
+         } else {
+            out << "   a = " << value(in.op1, true) << ";\n";
+            out << "   if (a - 3 < GVM_IO_SIZE - 3) { " << (op == OP_INC ? "++" : "--") << "io[a]; } else { STEP_NEXT("
+                << in.pc << "ULL, " << in.next << "ULL); }\n";
+         }
+         return;
+      case OP_ADD:
+      case OP_SUB:
+      case OP_MUL:
+      case OP_DIV:
+      case OP_MOD:
+      case OP_OR:
+      case OP_ANDL:
+      case OP_XOR:
+      case OP_SHL:
+      case OP_SHR:
+      case OP_AND:
+      case OP_EQ:
+      case OP_NE:
+      case OP_GT:
+      case OP_LT:
+      case OP_GE:
+      case OP_LE:
+      case OP_ORL: {
+         if (!direct(in.op1, p1) || !direct(in.op2, p2))
+            break;
+         out << "   opcode = " << int(op) << ";\n";
+         out << "   a = " << value(in.op1, p1) << ";\n";
+         out << "   b = " << value(in.op2, p2) << ";\n";
+         std::string fail = "FAIL(" + std::to_string(in.next) + "ULL, ";
+         switch (op) {
+         case OP_ADD:  out << "   R = a + b;\n"; break;
+         case OP_SUB:  out << "   R = a - b;\n   if (a < b) " << fail << ERR_NEGNUM << ");\n"; break;
+         case OP_MUL:  out << "   R = a * b;\n"; break;
+         case OP_DIV:  out << "   if (!b) " << fail << ERR_DIVZERO << ");\n   R = a / b;\n"; break;
+         case OP_MOD:  out << "   if (!b) " << fail << ERR_DIVZERO << ");\n   R = a % b;\n"; break;
+         case OP_OR:   out << "   R = a | b;\n"; break;
+         case OP_ANDL: out << "   R = a && b;\n"; break;
+         case OP_XOR:  out << "   R = a ^ b;\n"; break;
+         case OP_SHL:  out << "   R = a << (b & 63);\n"; break; // what x86 does with the interpreter's <<
+         case OP_SHR:  out << "   R = a >> (b & 63);\n"; break;
+         case OP_AND:  out << "   R = a & b;\n"; break;
+         case OP_EQ:   out << "   R = a == b;\n"; break;
+         case OP_NE:   out << "   R = a != b;\n"; break;
+         case OP_GT:   out << "   R = a > b;\n"; break;
+         case OP_LT:   out << "   R = a < b;\n"; break;
+         case OP_GE:   out << "   R = a >= b;\n"; break;
+         case OP_LE:   out << "   R = a <= b;\n"; break;
+         case OP_ORL:  out << "   R = a || b;\n"; break;
+         }
+         return;
+      }
+      case OP_NOT:
+      case OP_NEG:
+         if (!direct(in.op1, p1))
+            break;
+         out << "   opcode = " << int(op) << ";\n";
+         out << "   R = " << (op == OP_NOT ? "!" : "~") << value(in.op1, p1) << ";\n";
+         return;
+      case OP_JT:
+      case OP_JF:
+         if (!direct(in.op1, p1))
+            break;
+         out << "   opcode = " << int(op) << ";\n";
+         out << "   if (" << (op == OP_JF ? "!" : "") << value(in.op1, p1) << ") " << jump(in.op2, labels) << "\n";
+         return;
+      case OP_JFEQ:
+      case OP_JFNE:
+      case OP_JFGT:
+      case OP_JFLT:
+      case OP_JFGE:
+      case OP_JFLE:
+         if (!direct(in.op1, p1) || !direct(in.op2, p2))
+            break;
+         out << "   opcode = " << int(op) << ";\n";
+         out << "   if (!(" << value(in.op1, p1) << " " << compare(op - OP_JFEQ) << " " << value(in.op2, p2) << ")) "
+             << jump(in.addr, labels) << "\n";
+         return;
+      case OP_INCJEQ:
+      case OP_INCJNE:
+      case OP_INCJGT:
+      case OP_INCJLT:
+      case OP_INCJGE:
+      case OP_INCJLE:
+         if (p1 || !writable(in.op1) || !direct(in.op2, p2))
+            break;
+         out << "   opcode = " << int(op) << ";\n";
+         out << "   ++" << cell(in.op1) << ";\n";
+         out << "   R = " << cell(in.op1) << " " << compare(op - OP_INCJEQ) << " " << value(in.op2, p2) << ";\n";
+         out << "   if (R) " << jump(in.addr, labels) << "\n";
+         return;
+      }
+      // stack ops (PUSHED and STACK superinstructions included), CALL, RET,
+      // HOST, VPUSH/VPOP, invalid code, out-of-range constant addresses and
+      // writes to PC: all done by the VM
+      step(in);
+   }
+};
+
+int main(int argc, char* argv[]) {
+   if (argc != 2 && argc != 3) {
+      std::cerr << "Usage: " << argv[0] << " <filename> [output.c]" << std::endl;
+      return 1;
+   }
+
+   const char* filename = argv[1];
+   std::string error;
+   GProgram program = GProgram::open(filename, &error);
+   if (!program) {
+      std::cerr << "Error opening file: " << error << std::endl;
+      return 1;
+   }
+
+   std::ostringstream source;
+   GCompiler compiler(program, source);
+   compiler.compile(filename);
+
+   if (argc == 3) {
+      std::ofstream outFile(argv[2]);
+      if (!outFile.is_open()) {
+         std::cerr << "Error opening file: " << argv[2] << std::endl;
+         return 1;
+      }
+      outFile << source.str();
+   } else {
+      std::cout << source.str();
+   }
+
+   return 0;
+}